@@ -0,0 +1,52 @@
+#ifndef AliasTable_h
+#define AliasTable_h 1
+
+#include <vector>
+
+namespace overlay {
+
+  /**
+   *  @brief  AliasTable class
+   *
+   *  Walker alias table (Vose's construction) to sample an index from a discrete
+   *  distribution in O(1), with a single flat random number per draw.
+   */
+  class AliasTable {
+  public:
+    AliasTable() = default ;
+    AliasTable(const AliasTable&) = default ;
+    AliasTable& operator =(const AliasTable&) = default ;
+
+    /**
+     *  @brief  Build the table from (not necessarily normalized) weights.
+     *          Negative weights are treated as 0
+     *
+     *  @param  weights the weight of each index
+     */
+    void build( const std::vector<double>& weights ) ;
+
+    /**
+     *  @brief  Sample an index
+     *
+     *  @param  flat a random number uniformly distributed in [0,1)
+     */
+    unsigned int sample( double flat ) const ;
+
+    /**
+     *  @brief  Whether the table can be sampled, i.e. has at least one index with non zero weight
+     */
+    bool empty() const { return _probabilities.empty() ; }
+
+    /**
+     *  @brief  Get the number of indices in the table
+     */
+    unsigned int size() const { return _probabilities.size() ; }
+
+  private:
+    std::vector<double>            _probabilities {} ;    ///< The probability to keep the drawn column
+    std::vector<unsigned int>      _aliases {} ;          ///< The alias of each column
+  };
+
+} // namespace
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef BackgroundFileRegistry_h
+#define BackgroundFileRegistry_h 1
+
+#include "lcio.h"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace IO{
+  class LCReader ;
+}
+
+namespace EVENT{
+  class LCEvent ;
+}
+
+namespace overlay {
+
+  /**
+   *  @brief  BackgroundFile class
+   *
+   *  A background LCIO file opened once per job: the direct access reader and the
+   *  run/event map are shared by all processors that overlay events from this file.
+   *  Events returned by the read functions are owned by the reader and are only valid
+   *  until the next read from this file, by any processor.
+   */
+  class BackgroundFile {
+  public:
+    /**
+     *  @brief  Constructor
+     *
+     *  @param  fileName the name of the LCIO file
+     */
+    explicit BackgroundFile( const std::string& fileName ) ;
+
+    BackgroundFile(const BackgroundFile&) = delete ;
+    BackgroundFile& operator =(const BackgroundFile&) = delete ;
+
+    /**
+     *  @brief  Destructor, closes the file
+     */
+    ~BackgroundFile() ;
+
+    /**
+     *  @brief  Get the LCIO file name
+     */
+    const std::string& getFileName() const { return _fileName ; }
+
+    /**
+     *  @brief  Open the LCIO file and build its run/event map, if not yet done.
+     *          Thread safe and does not log, so that it can be called from worker threads
+     */
+    void index() ;
+
+    /**
+     *  @brief  Get the number of events available in the file
+     */
+    unsigned int getNumberOfEvents() ;
+
+    /**
+     *  @brief  Get the event number at the specified index (look in the event map)
+     *
+     *  @param  index the nth event to get
+     */
+    unsigned int getEventNumber( unsigned int index ) ;
+
+    /**
+     *  @brief  Get the run number at the specified index (look in the event map)
+     *
+     *  @param  index the nth run to get
+     */
+    unsigned int getRunNumber( unsigned int index ) ;
+
+    /**
+     *  @brief  Read the specified event, by run and event number
+     *
+     *  @param  runNumber the run number of the event to read
+     *  @param  eventNumber the event number of the event to read
+     *  @param  collectionNames the collections to read, all if null
+     */
+    EVENT::LCEvent* readEvent( int runNumber, int eventNumber, const EVENT::StringVec* collectionNames = nullptr ) ;
+
+    /**
+     *  @brief  Read the event at the specified index of the event map. If the event directly
+     *          follows the previously read one, it is streamed with readNextEvent() instead of
+     *          a direct access seek
+     *
+     *  @param  index the nth event to read
+     *  @param  collectionNames the collections to read, all if null
+     */
+    EVENT::LCEvent* readEventAt( unsigned int index, const EVENT::StringVec* collectionNames = nullptr ) ;
+
+  private:
+    /**
+     *  @brief  Open the file on first use, with logging
+     */
+    void openFile() ;
+
+    /**
+     *  @brief  Set the collections read by the reader, if different from the previous read
+     *
+     *  @param  collectionNames the collections to read, all if null
+     */
+    void setReadCollectionNames( const EVENT::StringVec* collectionNames ) ;
+
+  private:
+    std::mutex                            _mutex {} ;            ///< Protects the file opening
+    std::unique_ptr<IO::LCReader>         _lcReader {} ;         ///< The LCIO file reader
+    EVENT::IntVec                         _eventMap {} ;         ///< The run and event number
+    EVENT::StringVec                      _readCollectionNames {} ; ///< The collections read by the reader, all if empty
+    std::string                           _fileName {} ;         ///< The LCIO file name
+    unsigned int                          _nextIndex {0} ;       ///< The event map index following the last read event
+    std::atomic<bool>                     _isOpen {false} ;      ///< Whether the file has been opened and indexed, set last
+  };
+
+  /**
+   *  @brief  BackgroundFileRegistry class
+   *
+   *  Process wide registry of the background files, keyed by file name. Files are shared
+   *  (reference counted) between all processor instances of a job and closed when the
+   *  last user releases them.
+   */
+  class BackgroundFileRegistry {
+  public:
+    /**
+     *  @brief  Get the registry instance
+     */
+    static BackgroundFileRegistry& instance() ;
+
+    /**
+     *  @brief  Get the shared background file for the given file name, create it if needed
+     *
+     *  @param  fileName the name of the LCIO file
+     */
+    std::shared_ptr<BackgroundFile> acquire( const std::string& fileName ) ;
+
+  private:
+    BackgroundFileRegistry() = default ;
+    BackgroundFileRegistry(const BackgroundFileRegistry&) = delete ;
+    BackgroundFileRegistry& operator =(const BackgroundFileRegistry&) = delete ;
+
+  private:
+    std::mutex                                              _mutex {} ;     ///< Protects the file map
+    std::map<std::string, std::weak_ptr<BackgroundFile>>    _files {} ;     ///< The files in use, by file name
+  };
+
+} // namespace
+
+#endif
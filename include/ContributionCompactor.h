@@ -0,0 +1,123 @@
+#ifndef ContributionCompactor_h
+#define ContributionCompactor_h 1
+
+#include "lcio.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace EVENT{
+  class MCParticle ;
+}
+
+namespace IMPL{
+  class SimCalorimeterHitImpl ;
+}
+
+namespace overlay {
+
+  /**
+   *  @brief  CompactionMode enum. How background MC contributions are stored in calorimeter hits
+   */
+  enum CompactionMode {
+    kNoCompaction = 0,          ///< one contribution per background contribution (no compaction)
+    kTimeBinnedCompaction,      ///< one contribution per cell and time bin
+    kEnergyOnlyCompaction       ///< one contribution per cell
+  };
+
+  /**
+   *  @brief  Get the compaction mode from its name: None, TimeBinned or EnergyOnly
+   *
+   *  @param  name the mode name
+   *  @param  mode the mode, set if the name is valid
+   *  @return whether the name is valid
+   */
+  bool compactionModeFromString( const std::string& name, CompactionMode& mode ) ;
+
+  /**
+   *  @brief  ContributionCompactor class
+   *
+   *  Collects the background MC contributions added to SimCalorimeterHits during an event
+   *  and writes them aggregated, per cell and time bin (or per cell only), when flushed at
+   *  the end of the event. An aggregated contribution has the summed energy, the energy
+   *  weighted time and the most energetic contributing particle. Contributions already in
+   *  the hits (e.g. from the physics event) are not touched.
+   */
+  class ContributionCompactor {
+  public:
+    ContributionCompactor() = default ;
+    ContributionCompactor(const ContributionCompactor&) = delete ;
+    ContributionCompactor& operator =(const ContributionCompactor&) = delete ;
+
+    /**
+     *  @brief  Set the compaction mode
+     *
+     *  @param  mode the compaction mode
+     *  @param  timeBin the time bin width (ns), for the time binned mode
+     */
+    void setMode( CompactionMode mode, float timeBin ) ;
+
+    /**
+     *  @brief  Whether contributions are compacted at all
+     */
+    bool enabled() const { return kNoCompaction != _mode ; }
+
+    /**
+     *  @brief  Add a background contribution to a hit, written at flush()
+     *
+     *  @param  hit the hit receiving the contribution
+     *  @param  particle the contributing particle
+     *  @param  energy the contribution energy
+     *  @param  time the contribution time
+     */
+    void add( IMPL::SimCalorimeterHitImpl* hit, EVENT::MCParticle* particle, float energy, float time ) ;
+
+    /**
+     *  @brief  Write the aggregated contributions to their hits
+     */
+    void flush() ;
+
+    /**
+     *  @brief  Drop the pending contributions
+     */
+    void clear() ;
+
+    /**
+     *  @brief  Whether there are contributions waiting for flush()
+     */
+    bool empty() const { return _hits.empty() ; }
+
+    /**
+     *  @brief  Get the total number of contributions added
+     */
+    unsigned long getNAdded() const { return _nAdded ; }
+
+    /**
+     *  @brief  Get the total number of aggregated contributions written
+     */
+    unsigned long getNWritten() const { return _nWritten ; }
+
+  private:
+    /**
+     *  @brief  Bin struct. The aggregated contributions of a hit in a time bin
+     */
+    struct Bin {
+      long long              index {0} ;               ///< The time bin index
+      EVENT::MCParticle*     particle {nullptr} ;      ///< The most energetic particle
+      float                  maxEnergy {0.} ;          ///< The energy of the most energetic contribution
+      double                 energy {0.} ;             ///< The summed energy
+      double                 energyTime {0.} ;         ///< The summed energy * time
+      float                  firstTime {0.} ;          ///< The time of the first contribution, used if no energy
+    };
+
+    CompactionMode                                                      _mode {kNoCompaction} ;   ///< The compaction mode
+    float                                                               _timeBin {1.} ;           ///< The time bin width
+    std::unordered_map<IMPL::SimCalorimeterHitImpl*, std::vector<Bin>>  _bins {} ;                ///< The pending bins, by hit
+    std::vector<IMPL::SimCalorimeterHitImpl*>                           _hits {} ;                ///< The hits with pending bins, in order of arrival
+    unsigned long                                                       _nAdded {0} ;             ///< The number of contributions added
+    unsigned long                                                       _nWritten {0} ;           ///< The number of contributions written
+  };
+
+} // namespace
+
+#endif
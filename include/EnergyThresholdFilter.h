@@ -0,0 +1,198 @@
+#ifndef EnergyThresholdFilter_h
+#define EnergyThresholdFilter_h 1
+
+#include "lcio.h"
+#include <map>
+#include <string>
+#include <vector>
+
+namespace EVENT{
+  class LCCollection ;
+  class SimCalorimeterHit ;
+}
+
+namespace IMPL{
+  class SimCalorimeterHitImpl ;
+}
+
+namespace overlay {
+
+  /**
+   *  @brief  ThresholdMode enum. What the background energy threshold of a collection is applied to
+   */
+  enum ThresholdMode {
+    kContributionThreshold = 0,   ///< each background MC contribution, when merged
+    kCellSumThreshold             ///< the energy sum of the cells created by the background, after merging
+  };
+
+  /**
+   *  @brief  Get the threshold mode from its name: Contribution or CellSum
+   *
+   *  @param  name the mode name
+   *  @param  mode the mode, set if the name is valid
+   *  @return whether the name is valid
+   */
+  bool thresholdModeFromString( const std::string& name, ThresholdMode& mode ) ;
+
+  /**
+   *  @brief  EnergyThresholdFilter class
+   *
+   *  Drops background SimCalorimeterHit energy below a per collection threshold while merging.
+   *  In the Contribution mode, each background MC contribution below the threshold is dropped,
+   *  see select(). In the CellSum mode, the cells created by the background are collected with
+   *  watch() and the ones with an energy sum below the threshold are removed from their collection
+   *  by flush(), once all background contributions (and compacted ones) have been written.
+   *  Hits already in the destination collection (e.g. from the physics event) are never dropped.
+   */
+  class EnergyThresholdFilter {
+  public:
+    EnergyThresholdFilter() = default ;
+    EnergyThresholdFilter(const EnergyThresholdFilter&) = delete ;
+    EnergyThresholdFilter& operator =(const EnergyThresholdFilter&) = delete ;
+
+    /**
+     *  @brief  Set the thresholds
+     *
+     *  @param  thresholds the energy thresholds (GeV), by destination collection name
+     *  @param  mode what the thresholds are applied to
+     */
+    void setThresholds( const std::map<std::string, float>& thresholds, ThresholdMode mode ) ;
+
+    /**
+     *  @brief  Whether any collection has a threshold
+     */
+    bool enabled() const { return not _thresholds.empty() ; }
+
+    /**
+     *  @brief  Get the threshold mode
+     */
+    ThresholdMode mode() const { return _mode ; }
+
+    /**
+     *  @brief  Get the threshold of a collection, 0 if none
+     *
+     *  @param  collectionName the destination collection name
+     */
+    float threshold( const std::string& collectionName ) const ;
+
+    /**
+     *  @brief  Set the destination collection merged next. The following calls to active(),
+     *          select() and watch() apply to this collection
+     *
+     *  @param  collection the destination collection
+     *  @param  collectionName the destination collection name
+     */
+    void beginCollection( EVENT::LCCollection* collection, const std::string& collectionName ) ;
+
+    /**
+     *  @brief  Get the current destination collection
+     */
+    EVENT::LCCollection* collection() const { return _collection ; }
+
+    /**
+     *  @brief  Whether the current destination collection has a threshold
+     */
+    bool active() const { return _threshold > 0. ; }
+
+    /**
+     *  @brief  Whether the background contributions of the current collection are filtered one by one
+     */
+    bool filtersContributions() const { return active() && kContributionThreshold == _mode ; }
+
+    /**
+     *  @brief  Select the MC contributions of a hit at or above the threshold of the current collection.
+     *          Use selected() to get the result and reject() to account for the dropped contributions
+     *
+     *  @param  hit the background hit
+     *  @return the number of selected contributions
+     */
+    int select( const EVENT::SimCalorimeterHit* hit ) ;
+
+    /**
+     *  @brief  Whether a contribution passed the last select()
+     *
+     *  @param  index the contribution index in the hit given to select()
+     */
+    bool selected( int index ) const { return 0 != _selected[ index ] ; }
+
+    /**
+     *  @brief  Account for a dropped contribution
+     *
+     *  @param  energy the contribution energy
+     */
+    void reject( float energy ) {
+      ++_nRejectedContributions ;
+      _rejectedContributionEnergy += energy ;
+    }
+
+    /**
+     *  @brief  Record a cell created by the background in the current collection, checked against
+     *          its threshold by flush(). Does nothing if not in CellSum mode or no threshold
+     *
+     *  @param  hit the new hit, already in the current collection
+     */
+    void watch( IMPL::SimCalorimeterHitImpl* hit ) ;
+
+    /**
+     *  @brief  Remove (and delete) the watched cells below their threshold from their collection
+     *
+     *  @return the number of removed cells
+     */
+    unsigned int flush() ;
+
+    /**
+     *  @brief  Drop the watched cells and the current collection
+     */
+    void clear() ;
+
+    /**
+     *  @brief  Whether there are cells waiting for flush()
+     */
+    bool empty() const { return _watched.empty() ; }
+
+    /**
+     *  @brief  Get the total number of dropped contributions (Contribution mode)
+     */
+    unsigned long getNRejectedContributions() const { return _nRejectedContributions ; }
+
+    /**
+     *  @brief  Get the total energy of the dropped contributions (Contribution mode)
+     */
+    double getRejectedContributionEnergy() const { return _rejectedContributionEnergy ; }
+
+    /**
+     *  @brief  Get the total number of removed cells (CellSum mode)
+     */
+    unsigned long getNRejectedCells() const { return _nRejectedCells ; }
+
+    /**
+     *  @brief  Get the total energy of the removed cells (CellSum mode)
+     */
+    double getRejectedCellEnergy() const { return _rejectedCellEnergy ; }
+
+  private:
+    /**
+     *  @brief  WatchedCell struct. A cell created by the background
+     */
+    struct WatchedCell {
+      EVENT::LCCollection*             collection {nullptr} ;   ///< The collection of the hit
+      IMPL::SimCalorimeterHitImpl*     hit {nullptr} ;          ///< The hit
+      float                            threshold {0.} ;         ///< The threshold of the collection
+    };
+
+    std::map<std::string, float>       _thresholds {} ;                   ///< The thresholds, by collection name
+    ThresholdMode                      _mode {kContributionThreshold} ;   ///< The threshold mode
+    EVENT::LCCollection*               _collection {nullptr} ;            ///< The current destination collection
+    float                              _threshold {0.} ;                  ///< The threshold of the current collection
+    std::vector<float>                 _energies {} ;                     ///< Contribution energies of the last selected hit
+    std::vector<unsigned char>         _selected {} ;                     ///< Selection flags of the last selected hit
+    std::vector<WatchedCell>           _watched {} ;                      ///< The cells to check in flush()
+    unsigned long                      _nRejectedContributions {0} ;      ///< The number of dropped contributions
+    double                             _rejectedContributionEnergy {0.} ; ///< The energy of the dropped contributions
+    unsigned long                      _nRejectedCells {0} ;              ///< The number of removed cells
+    double                             _rejectedCellEnergy {0.} ;         ///< The energy of the removed cells
+  };
+
+} // namespace
+
+#endif
@@ -4,6 +4,8 @@
 #include "marlin/Processor.h"
 #include "marlin/EventModifier.h"
 #include "lcio.h"
+#include "FPCCDPixelAccumulator.h"
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -15,12 +17,15 @@ typedef std::vector< AIDA::IHistogram1D* > Hist1DVec ;
 
 namespace overlay{
 
+  class BackgroundFile ;
 
   /** FPCCDOverlayBX processor for overlaying (pair) background from many bunch crossings.
    *  Only VTXPixelHits which is output of FPCCDDigitizer are overlayed for the number of 
    *  bunchcrossings that will be visible for a given physics events. 
    *  <b>Note: code assumes that background files contain exactly one bunch crossing - this is necesassary as 
    *     guineapig files are ordered.</b>
+   *  The signal pixel hits of the event are summed with the background ones, pixel by pixel, and VTXPixelHits
+   *  is replaced by the packed sum.
    * 
    *  @author D. Kamai Tohoku univ. (based on OverlayBX processor by F. Geade)
 
@@ -39,6 +44,17 @@ namespace overlay{
    *  @param MaxNumberOfEventsPerFile (int)
    *  Maximum number of background events to be read from one file. Default: -1, i.e. read one file per BX.
    *  This option is essentially for testing. 
+   *
+   *  @param PixelThreads (int) Number of threads summing the pixel hits of a BX, ladder by ladder. Default: 1.
+   *
+   *  @param FrameMode (string) None (default): NumberOfBunchCrossings background files are read and summed per event. 
+   *  Generate: readout frames, the pixel hits of NumberOfBunchCrossings files summed and packed, are written once in 
+   *  init() to the first of FrameFiles (one event per frame, collection VTXPixelHits); the events are not modified.
+   *  Consume: one frame per event is overlaid, a random frame of a random file of FrameFiles.
+   *
+   *  @param FrameFiles (StringVec) The frame file to write (Generate) or the frame files to read (Consume).
+   *
+   *  @param NumberOfFrames (int) Number of frames to generate. Default: -1, i.e. as many as the background files allow.
    */
 
   class FPCCDOverlayBX : public marlin::Processor, public marlin::EventModifier {
@@ -82,13 +98,28 @@ namespace overlay{
     //  LCEvent*  readNextEvent(int bxNum) ;
 
     LCEvent*  readNextEvent(int bxNum) ;
+
+    /** helper function: make all input files available again */
+    void resetFileQueue() ;
+
+    /** helper function: close the reader of the current BX, if any */
+    void closeCurrentReader() ;
+
+    /** helper function: sum the pixel hits of the next numBX background files, returns the number of hits */
+    int accumulateBXs(int numBX) ;
+
+    /** helper function: write the readout frames */
+    void generateFrames() ;
+
+    /** helper function: overlay a random readout frame. With mergeSignal, its pixel hits are summed in the
+     *  pixel accumulator (number of pixel hits returned), otherwise its packed objects are moved to vxdCol */
+    int overlayFrame(LCCollection* vxdCol, bool mergeSignal) ;
   
     /** helper function */
     void init_geometry() ;
 
     // ---- variables for processor parameters ----- 
     StringVec   _inputFileNames{};
-    StringVec   _tmpInputFileNames{}; // not read same file twice or more.
     int         _eventsPerBX = -1;
     int         _numBX = 100;
     bool        _removeVTX = false;
@@ -98,12 +129,19 @@ namespace overlay{
     StringVec   _mergeCollections{"VTXPixelHits", "VTXPixelHits"} ;
     int         _nLayer = 0;
     int         _maxLadder = 0;
+    int         _nPixelThreads = 1;
+    std::string _frameModeName = "None";
+    StringVec   _frameFiles{};
+    int         _nFrames = -1;
     //---- class member variables ------
     typedef std::map<std::string, std::string> StrMap ;
     StrMap _colMap{};
     //  std::map<std::string, std::string> _colMap;
 
     std::vector< LCReader* > _lcReaders{};
+    std::vector< unsigned int > _fileQueue{};   // input files not read yet, taken from the back
+    int _currentRdr = -1;                       // reader of the current BX, -1 if none
+    int _lastBXNum = -1;                        // BX read by the current reader
     //int _maxBXs ;
     int _nRun = 0;
     int _nEvt = 0;
@@ -113,6 +151,15 @@ namespace overlay{
     };
     std::vector<GeoData_t> _geodata{};
 
+    FPCCDPixelAccumulator _pixelAccumulator{};   // background pixel hits of all BXs of the event
+
+    /** What the readout frames are used for */
+    enum FrameMode { kNoFrames = 0 , kGenerateFrames , kConsumeFrames } ;
+
+    FrameMode _frameMode = kNoFrames;
+    std::vector< std::shared_ptr<BackgroundFile> > _frameInputs{};   // inputs of the Consume mode
+    unsigned long _nFramesUsed = 0;                                // frames written or overlaid
+
 #ifdef MARLIN_USE_AIDA
     Hist1DVec _hist1DVec{};
 #endif
@@ -0,0 +1,139 @@
+#ifndef FPCCDPixelAccumulator_h
+#define FPCCDPixelAccumulator_h 1
+
+#include "lcio.h"
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "FPCCDPixelHit.h"
+
+class FPCCDData ;
+
+namespace EVENT{
+  class LCCollection ;
+}
+
+namespace overlay {
+
+  /**
+   *  @brief  FPCCDPixelAccumulator class
+   *
+   *  Sums the FPCCD pixel hits of many bunch crossings and packs them once. Each ladder keeps a
+   *  sparse hash of its fired pixels with their energy sum: a pixel fired again only adds its energy,
+   *  no pixel hit object is allocated before packing. Ladders are independent and can be summed by
+   *  a pool of worker threads, started once in init() and woken for each bunch crossing. A pixel
+   *  fired in more than one bunch crossing is packed with the background overlap quality, or the
+   *  signal overlap quality if it was fired by the signal, as done by FPCCDData::Add().
+   */
+  class FPCCDPixelAccumulator {
+  public:
+    FPCCDPixelAccumulator() = default ;
+    ~FPCCDPixelAccumulator() ;
+    FPCCDPixelAccumulator(const FPCCDPixelAccumulator&) = delete ;
+    FPCCDPixelAccumulator& operator =(const FPCCDPixelAccumulator&) = delete ;
+
+    /**
+     *  @brief  Set the geometry and the number of threads, drops the accumulated pixels
+     *
+     *  @param  nLayers the number of layers
+     *  @param  maxLadder the maximum number of ladders per layer
+     *  @param  nThreads the number of threads summing the ladders, the calling one included. 1: no worker thread
+     */
+    void init( int nLayers, int maxLadder, unsigned int nThreads ) ;
+
+    /**
+     *  @brief  Add the pixel hits of a bunch crossing
+     *
+     *  @param  data the unpacked pixel hits, not modified
+     *  @param  signal whether these are the signal pixel hits, added first: the background hits
+     *          then fired in the same pixels get the signal overlap quality
+     *  @return the number of pixel hits added
+     */
+    unsigned int add( FPCCDData& data, bool signal = false ) ;
+
+    /**
+     *  @brief  Pack the accumulated pixels into a collection and drop them
+     *
+     *  @param  collection the collection of LCGenericObjects to add the packed pixel hits to
+     */
+    void pack( EVENT::LCCollection& collection ) ;
+
+    /**
+     *  @brief  Drop the accumulated pixels
+     */
+    void clear() ;
+
+    /**
+     *  @brief  Get the number of fired pixels
+     */
+    unsigned int getNPixels() const ;
+
+  private:
+    /**
+     *  @brief  Add the pixel hits of a ladder
+     *
+     *  @param  data the unpacked pixel hits
+     *  @param  index the ladder index, layer * maxLadder + ladder
+     *  @return the number of pixel hits added
+     */
+    unsigned int addLadder( FPCCDData& data, unsigned int index ) ;
+
+    /**
+     *  @brief  Add the ladders not taken yet by another thread, for the current bunch crossing
+     *
+     *  @param  data the unpacked pixel hits
+     *  @param  thread the thread index, 0 for the calling thread
+     */
+    void addLadders( FPCCDData& data, unsigned int thread ) ;
+
+    /**
+     *  @brief  Worker thread: sums ladders each time a bunch crossing is added, until stopped
+     *
+     *  @param  thread the thread index, from 1
+     *  @param  generation the number of bunch crossings added when the thread was started
+     */
+    void work( unsigned int thread, unsigned long generation ) ;
+
+    /**
+     *  @brief  Stop and join the worker threads
+     */
+    void stopWorkers() ;
+
+    /**
+     *  @brief  PixelSum struct. A fired pixel
+     */
+    struct PixelSum {
+      float                         edep {0.} ;                       ///< The energy sum
+      FPCCDPixelHit::HitQuality     quality {FPCCDPixelHit::kSingle} ; ///< The hit quality
+      bool                          signal {false} ;                  ///< Whether the pixel was fired by the signal
+    };
+
+    typedef std::unordered_map<unsigned long long, PixelSum> LadderPixels ;
+
+    std::vector<LadderPixels>     _ladders {} ;      ///< The fired pixels by (xi, zeta), per ladder
+    int                           _nLayers {0} ;     ///< The number of layers
+    int                           _maxLadder {0} ;   ///< The maximum number of ladders per layer
+    unsigned int                  _nThreads {1} ;    ///< The number of threads summing the ladders
+
+    std::vector<std::thread>      _workers {} ;      ///< The worker threads, _nThreads-1
+    std::mutex                    _poolMutex {} ;    ///< Protects the pool state below
+    std::condition_variable       _poolStart {} ;    ///< Wakes the workers for a bunch crossing
+    std::condition_variable       _poolDone {} ;     ///< Wakes add() when the last worker is done
+    FPCCDData*                    _poolData {nullptr} ;  ///< The pixel hits of the bunch crossing being added
+    unsigned long                 _poolGeneration {0} ;  ///< The number of bunch crossings given to the workers
+    unsigned int                  _nBusyWorkers {0} ;    ///< The workers not done with the bunch crossing
+    bool                          _stopWorkers {false} ; ///< Whether the workers have to stop
+    bool                          _addingSignal {false} ; ///< Whether the bunch crossing being added is the signal
+    std::atomic<unsigned int>     _nextLadder {0} ;  ///< The next ladder to take
+    std::atomic<unsigned int>     _nAddedHits {0} ;  ///< The pixel hits added for the bunch crossing
+    std::vector<std::exception_ptr> _errors {} ;     ///< The exception thrown by each thread, if any
+  };
+
+} // namespace
+
+#endif
@@ -0,0 +1,265 @@
+#ifndef MergeContext_h
+#define MergeContext_h 1
+
+#include "lcio.h"
+#include "ContributionCompactor.h"
+#include "EnergyThresholdFilter.h"
+#include <map>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+namespace EVENT{
+  class LCEvent ;
+  class LCCollection ;
+  class LCObject ;
+}
+
+class FPCCDData ;
+
+namespace overlay {
+
+  /**
+   *  @brief  DuplicateHitPolicy enum. What to do with a source hit falling in the same
+   *          cell as a destination hit, for the digitised tracker hit types
+   */
+  enum DuplicateHitPolicy {
+    kKeepDuplicates = 0,      ///< keep both hits (plain concatenation)
+    kKeepFirst,               ///< keep the destination hit, drop the source hit
+    kSumDuplicates            ///< sum the source hit into the destination hit
+  };
+
+  /**
+   *  @brief  MergeOptions struct. Configuration of the merge kernels
+   */
+  struct MergeOptions {
+    DuplicateHitPolicy     trackerHitPlanePolicy {kKeepDuplicates} ;   ///< The duplicate policy for TRACKERHITPLANE
+    double                 trackerHitPlaneGrid {0.} ;                  ///< The position grid (mm) defining a cell within a cellID, 0: cellID only
+    int                    pixelLayers {6} ;                           ///< The number of FPCCD vertex detector layers
+    int                    pixelMaxLadder {17} ;                       ///< The maximum number of ladders per FPCCD layer
+    CompactionMode         compaction {kNoCompaction} ;                ///< The compaction of background SimCalorimeterHit contributions
+    float                  compactionTimeBin {1.} ;                    ///< The time bin width (ns) of the time binned compaction
+    std::map<std::string, float>  energyThresholds {} ;                ///< The background SimCalorimeterHit energy thresholds (GeV), by destination collection name
+    ThresholdMode          thresholdMode {kContributionThreshold} ;    ///< What the energy thresholds are applied to
+    std::map<std::string, float>  simTrackerHitCellGrids {} ;          ///< The destination SimTrackerHit collections whose background hits are aggregated per cell, 
+                                                                       ///< with the position grid (mm) defining a cell within a cellID, 0: cellID only
+  };
+
+  /**
+   *  @brief  Parse the (collection name, value) pairs of a processor parameter
+   *
+   *  @param  pairs the collection names, each followed by its value
+   *  @param  values the values by collection name, filled
+   *  @return false if the number of entries is odd or a value is not a number
+   */
+  bool collectionValuesFromStrings( const EVENT::StringVec& pairs, std::map<std::string, float>& values ) ;
+
+  /**
+   *  @brief  Get the position grid cell of a hit within its cellID: 21 bits per coordinate
+   *
+   *  @param  pos the hit position
+   *  @param  grid the grid size (mm), 0 if no grid
+   *  @return the packed grid indices, 0 if no grid
+   */
+  inline long long gridCell( const double* pos, double grid ) {
+    if( grid <= 0. ) {
+      return 0 ;
+    }
+
+    long long cell = 0 ;
+    for( int k=0 ; k<3 ; k++ ) {
+      cell = ( cell << 21 ) | ( static_cast<long long>( std::floor( pos[k] / grid ) ) & 0x1FFFFF ) ;
+    }
+    return cell ;
+  }
+
+  /**
+   *  @brief  Set the FPCCD pixel geometry of the merge options from the GEAR VXD parameters.
+   *          The options are left unchanged if GEAR or the VXD parameters are not available
+   *
+   *  @param  options the merge options to update
+   *  @return whether the geometry was found in GEAR
+   */
+  bool setPixelGeometryFromGear( MergeOptions& options ) ;
+
+  /**
+   *  @brief  MergeContext class
+   *
+   *  State of the merging into one destination (physics) event, kept across all the
+   *  Merger::merge calls for this event. Holds a cell index per destination calorimeter
+   *  (or digitised tracker) hit collection, extended incrementally as hits are appended, so that overlaying
+   *  n events does not re-index the growing destination collection n times.
+   *  FPCCD pixel hits (LCGENERICOBJECT) are accumulated per destination collection and
+   *  only packed once, by flush(), which has to be called when all the merges into the
+   *  destination event are done. The same holds for compacted background SimCalorimeterHit
+   *  contributions (see ContributionCompactor) and for the cell sum energy thresholds
+   *  (see EnergyThresholdFilter).
+   *  All the state is dropped automatically when the destination event changes,
+   *  except the merge options.
+   */
+  class MergeContext {
+  public:
+    /**
+     *  @brief  CellIndex struct. The cellID -> hit lookup of a destination collection
+     */
+    struct CellIndex {
+      std::unordered_map<long long, EVENT::LCObject*>   cells {} ;        ///< The hits, by combined cellID0/cellID1
+      unsigned int                                      nIndexed {0} ;    ///< The number of collection elements already indexed
+    };
+
+    /**
+     *  @brief  GridCellKey: combined cellID0/cellID1 and packed position grid indices
+     */
+    typedef std::pair<long long, long long> GridCellKey ;
+
+    /**
+     *  @brief  GridCellKeyHash struct
+     */
+    struct GridCellKeyHash {
+      std::size_t operator()( const GridCellKey& key ) const {
+        return std::hash<long long>()( key.first ) ^ ( std::hash<long long>()( key.second ) * 0x9e3779b97f4a7c15ULL ) ;
+      }
+    };
+
+    /**
+     *  @brief  GridCellIndex struct. The (cellID, position grid cell) -> hit lookup of a destination collection
+     */
+    struct GridCellIndex {
+      std::unordered_map<GridCellKey, EVENT::LCObject*, GridCellKeyHash>   cells {} ;        ///< The hits, by cell key
+      unsigned int                                                         nIndexed {0} ;    ///< The number of collection elements already indexed
+    };
+
+    /**
+     *  @brief  PixelAccumulator struct. The unpacked FPCCD pixel hits of a destination collection
+     */
+    struct PixelAccumulator {
+      ~PixelAccumulator() ;
+
+      std::unique_ptr<FPCCDData>   hits {} ;       ///< The accumulated pixel hits
+      std::unique_ptr<FPCCDData>   buffer {} ;     ///< Re-used buffer to unpack the source pixel hits
+    };
+
+  public:
+    MergeContext() ;
+    ~MergeContext() ;
+    MergeContext(const MergeContext&) = delete ;
+    MergeContext& operator =(const MergeContext&) = delete ;
+
+    /**
+     *  @brief  Set the destination event. Clears the context if this is not
+     *          the event the context was filled for
+     *
+     *  @param  evt the destination event
+     */
+    void beginEvent( EVENT::LCEvent* evt ) ;
+
+    /**
+     *  @brief  Drop all the per event state. The options are kept
+     */
+    void clear() ;
+
+    /**
+     *  @brief  Get the merge options
+     */
+    const MergeOptions& options() const { return _options ; }
+
+    /**
+     *  @brief  Set the merge options
+     *
+     *  @param  options the merge options
+     */
+    void setOptions( const MergeOptions& options ) ;
+
+    /**
+     *  @brief  Set the destination collection merged next, with its name, for the per collection 
+     *          options (energy threshold, SimTrackerHit aggregation)
+     *
+     *  @param  dest the destination collection
+     *  @param  destName the destination collection name
+     */
+    void beginCollection( EVENT::LCCollection* dest, const std::string& destName ) ;
+
+    /**
+     *  @brief  Get the destination collection given to the last beginCollection()
+     */
+    EVENT::LCCollection* collection() const { return _collection ; }
+
+    /**
+     *  @brief  Whether the background SimTrackerHits of a destination collection are aggregated per cell
+     *
+     *  @param  dest the destination collection, must be the one given to the last beginCollection()
+     *  @param  grid set to the position grid (mm) defining a cell within a cellID, 0: cellID only
+     */
+    bool simTrackerHitCellGrid( const EVENT::LCCollection* dest, double& grid ) const ;
+
+    /**
+     *  @brief  Get the background contribution compactor
+     */
+    ContributionCompactor& compactor() { return _compactor ; }
+
+    /**
+     *  @brief  Get the background energy threshold filter
+     */
+    EnergyThresholdFilter& energyFilter() { return _energyFilter ; }
+
+    /**
+     *  @brief  Get the cell index of a destination collection, empty if new.
+     *          The index is only valid as long as elements are appended to the collection:
+     *          it is rebuilt if the collection shrinks
+     *
+     *  @param  dest the destination collection
+     */
+    CellIndex& cellIndex( EVENT::LCCollection* dest ) ;
+
+    /**
+     *  @brief  Get the position grid cell index of a destination collection, empty if new.
+     *          Same validity as cellIndex()
+     *
+     *  @param  dest the destination collection
+     */
+    GridCellIndex& gridCellIndex( EVENT::LCCollection* dest ) ;
+
+    /**
+     *  @brief  Get the position grid cell index of the background hits merged into a destination
+     *          collection in this event, empty if new. Filled by the caller
+     *
+     *  @param  dest the destination collection
+     */
+    GridCellIndex& backgroundCellIndex( EVENT::LCCollection* dest ) { return _backgroundCellIndices[ dest ] ; }
+
+    /**
+     *  @brief  Get the pixel hit accumulator of a destination collection. On first use in
+     *          the event, the pixel hits of the collection are unpacked into the accumulator 
+     *          and the collection is emptied until flush()
+     *
+     *  @param  dest the destination collection
+     */
+    PixelAccumulator& pixelAccumulator( EVENT::LCCollection* dest ) ;
+
+    /**
+     *  @brief  Pack the accumulated pixel hits into their destination collections, write
+     *          the compacted contributions and remove the background cells below their cell sum
+     *          threshold. To be called once all merges into the destination event are done
+     */
+    void flush() ;
+
+  private:
+    MergeOptions                                             _options {} ;           ///< The merge options
+    EVENT::LCEvent*                                          _event {nullptr} ;      ///< The current destination event
+    int                                                      _runNumber {-1} ;       ///< The run number of the current destination event
+    int                                                      _eventNumber {-1} ;     ///< The event number of the current destination event
+    std::unordered_map<EVENT::LCCollection*, CellIndex>      _cellIndices {} ;       ///< The cell indices, by destination collection
+    std::unordered_map<EVENT::LCCollection*, GridCellIndex>  _gridCellIndices {} ;   ///< The position grid cell indices, by destination collection
+    std::unordered_map<EVENT::LCCollection*, GridCellIndex>  _backgroundCellIndices {} ;  ///< The background hit indices, by destination collection
+    std::unordered_map<EVENT::LCCollection*, PixelAccumulator>  _pixelAccumulators {} ;  ///< The pixel hit accumulators, by destination collection
+    EVENT::LCCollection*                                     _collection {nullptr} ;  ///< The current destination collection
+    double                                                   _simTrackerHitGrid {-1.} ;  ///< The SimTrackerHit aggregation grid of the current collection, < 0: no aggregation
+    ContributionCompactor                                    _compactor {} ;         ///< The background contribution compactor
+    EnergyThresholdFilter                                    _energyFilter {} ;      ///< The background energy threshold filter
+  };
+
+} // namespace
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef MergePlan_h
+#define MergePlan_h 1
+
+#include "lcio.h"
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace EVENT{
+  class LCEvent ;
+  class LCCollection ;
+}
+
+namespace overlay {
+
+  /**
+   *  @brief  MergeKind enum. The merge kernel used for a collection type, 
+   *          resolved once per collection pair (see Merger)
+   */
+  enum MergeKind {
+    kMergeMCParticle = 0,        ///< MCPARTICLE: move and flag as overlay
+    kMergeGenericObject,         ///< LCGENERICOBJECT: FPCCD pixel hits
+    kMergeSimCalorimeterHit,     ///< SIMCALORIMETERHIT: merge MC contributions per cell
+    kMergeCalorimeterHit,        ///< CALORIMETERHIT: sum energy per cell
+    kMergeRawCalorimeterHit,     ///< RAWCALORIMETERHIT: sum amplitudes per cell
+    kMergeTrackerHitPlane,       ///< TRACKERHITPLANE: duplicate cell policy, see MergeOptions
+    kMergeSimTrackerHit,         ///< SIMTRACKERHIT: move, or aggregate the background hits per cell, see MergeOptions
+    kMergeCopy,                  ///< all other types: move the elements
+    kNMergeKinds
+  };
+
+  /**
+   *  @brief  Get the merge kernel for a collection type
+   *
+   *  @param  typeName the collection type name
+   */
+  MergeKind mergeKindFromType( const std::string& typeName ) ;
+
+  /**
+   *  @brief  CollectionIndex class
+   *
+   *  Hashed, non-throwing lookup of the collections of one (destination) event by name.
+   *  The index has to be kept in sync by the user when collections are added to the event.
+   */
+  class CollectionIndex {
+  public:
+    CollectionIndex() = default ;
+    CollectionIndex(const CollectionIndex&) = default ;
+    CollectionIndex& operator =(const CollectionIndex&) = default ;
+
+    /**
+     *  @brief  (Re-)index all collections of the given event
+     *
+     *  @param  evt the event to index
+     */
+    void reset( EVENT::LCEvent* evt ) ;
+
+    /**
+     *  @brief  Get the indexed event, nullptr if not yet indexed
+     */
+    EVENT::LCEvent* event() const { return _event ; }
+
+    /**
+     *  @brief  Find a collection by name, nullptr if not present in the event
+     *
+     *  @param  name the collection name
+     */
+    EVENT::LCCollection* find( const std::string& name ) const ;
+
+    /**
+     *  @brief  Register a collection that has been added to the indexed event
+     *
+     *  @param  name the collection name
+     *  @param  col the collection
+     */
+    void add( const std::string& name, EVENT::LCCollection* col ) ;
+
+  private:
+    EVENT::LCEvent*                                          _event {nullptr} ;   ///< The indexed event
+    std::unordered_map<std::string, EVENT::LCCollection*>    _collections {} ;    ///< The name -> collection lookup
+  };
+
+  /**
+   *  @brief  MergePlanEntry struct
+   *
+   *  One resolved (source -> destination) collection pair of a merge plan.
+   */
+  struct MergePlanEntry {
+    std::string         srcName {} ;               ///< The source collection name
+    std::string         destName {} ;              ///< The destination collection name
+    std::string         typeName {} ;              ///< The source collection type
+    MergeKind           kind {kMergeCopy} ;        ///< The merge kernel for this type
+    bool                createIfMissing {true} ;   ///< Whether to create the destination collection if missing
+  };
+
+  /**
+   *  @brief  MergePlan class
+   *
+   *  The list of collection pairs to merge for a given set of source collection names.
+   *  A plan is compiled once and can then be re-used for all source events with the
+   *  same collection names, without string maps or exception driven lookups.
+   */
+  class MergePlan {
+  public:
+    typedef std::vector<MergePlanEntry> Entries ;
+
+    MergePlan() = default ;
+    MergePlan(const MergePlan&) = default ;
+    MergePlan& operator =(const MergePlan&) = default ;
+
+    /**
+     *  @brief  Compile a merge plan for the collections of the source event
+     *
+     *  @param  srcEvent the source event
+     *  @param  mergeMap the (srcColName, destColName) map. If nullptr, all source collections
+     *                   are merged into a collection with the same name
+     *  @param  excludeCollections source collections to leave out of the plan
+     *  @param  createIfMissing whether destination collections should be created if missing
+     */
+    static MergePlan compile( EVENT::LCEvent* srcEvent,
+                              const std::map<std::string, std::string>* mergeMap,
+                              const EVENT::StringVec& excludeCollections = EVENT::StringVec(),
+                              bool createIfMissing = true ) ;
+
+    /**
+     *  @brief  Get the plan entries
+     */
+    const Entries& entries() const { return _entries ; }
+
+    /**
+     *  @brief  Whether the plan is empty
+     */
+    bool empty() const { return _entries.empty() ; }
+
+  private:
+    Entries             _entries {} ;     ///< The resolved collection pairs
+  };
+
+} // namespace
+
+#endif
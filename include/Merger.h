@@ -1,4 +1,6 @@
 #include "lcio.h"
+#include "MergePlan.h"
+#include "MergeContext.h"
 // #include "IMPL/SimCalorimeterHitImpl.h"
 // #include "IMPL/SimTrackerHitImpl.h" 
 //#include "EVENT/LCEvent.h" 
@@ -67,10 +69,27 @@ namespace overlay {
      * If srcCol does not exist, the pair will be ignored, 
      * if destCol does not exist, a new collection with the 
      * same type as srcCol will be created.<br>
+     * @param context Optional merge context of destEvent, see MergeContext. Should be given 
+     * when several events are merged into the same destEvent. MergeContext::flush() has to be 
+     * called once all merges into destEvent are done.<br>
      * 
      * calles  merge(EVENT::LCCollection*, EVENT::LCCollection*) internally
      */
-    static void merge(EVENT::LCEvent *srcEvent, EVENT::LCEvent *destEvent, std::map<std::string, std::string> *mergeMap);
+    static void merge(EVENT::LCEvent *srcEvent, EVENT::LCEvent *destEvent, std::map<std::string, std::string> *mergeMap, MergeContext* context = nullptr);
+
+    /** Merges the collections of the two events according to a precompiled merge plan<br>
+     *
+     * @param srcEvent source event. Must have the collection names the plan was compiled for.
+     * @param destEvent destination event
+     * @param plan The (src, dest) collection pairs to merge, see MergePlan::compile()
+     * @param destIndex Collection index of destEvent. Collections created in destEvent are added to it.<br>
+     * @param context Optional merge context of destEvent, see MergeContext. 
+     * MergeContext::flush() has to be called once all merges into destEvent are done.<br>
+     *
+     * No exceptions and no string maps are used for the collection lookup. <br>
+     * calles  merge(EVENT::LCCollection*, EVENT::LCCollection*, MergeKind) internally
+     */
+    static void merge(EVENT::LCEvent *srcEvent, EVENT::LCEvent *destEvent, const MergePlan& plan, CollectionIndex& destIndex, MergeContext* context = nullptr);
 
     /** Merges the two named collections in the given events 
      * 
@@ -91,6 +110,8 @@ namespace overlay {
      *  - SIMCALORIMETERHIT
      *  - TRACKERHIT
      *  - CALORIMETERHIT
+     *  - RAWCALORIMETERHIT
+     *  - TRACKERHITPLANE
      * 
      * Algorithm:
      * MCPARTICLE, SIMTRACKERHIT, TRACKERHIT: All Hits from the source 
@@ -100,6 +121,18 @@ namespace overlay {
      * will be added to it. Otherwiese the hit will be copied into the 
      * destination collection. (In case of simulated data the MCParticle 
      * contributions will be preserved.)
+     * RAWCALORIMETERHIT: same as CALORIMETERHIT, the amplitudes (ADC counts) 
+     * are summed and the earliest time stamp is kept.
+     * SIMTRACKERHIT: copied, unless the destination collection is listed in the 
+     * MergeOptions::simTrackerHitCellGrids of the merge context. Source hits in the same cell 
+     * (cellID and optional position grid) as a source hit merged before into the same destination 
+     * collection in this event are then summed into it (EDep summed, earliest time) and deleted. 
+     * Hits of the physics event are not touched.
+     * TRACKERHITPLANE: copied, unless a duplicate policy is set in the 
+     * MergeOptions of the merge context. A cell is then given by the cellID and 
+     * optionally a position grid. A source hit in the same cell as a destination 
+     * hit is either dropped (KeepFirst) or summed into it (Sum: EDep summed, 
+     * EDep weighted position, earliest time, raw hits appended).
      * 
      * !! It is the callers responsability to make sure the mcParticles
      * pointed to by the hits do exist !!<br>
@@ -109,7 +142,40 @@ namespace overlay {
      */
     static void merge(EVENT::LCCollection* src, EVENT::LCCollection* dest);
 
+    /** Same as merge(EVENT::LCCollection*, EVENT::LCCollection*), with the merge kernel already 
+     * resolved, e.g. by a MergePlan. No type checks are done: both collections must be of the 
+     * type the kernel was resolved for, the elements are accessed with unchecked static casts.
+     *
+     * @param src Collection containing the entries that should be added to another collection.
+     * @param dest Collection to which the new entries should be added.
+     * @param kind The merge kernel, see mergeKindFromType()
+     * @param context Optional merge context of the destination event. If given, the per cell 
+     * index of calorimeter hit collections is kept and extended across calls and FPCCD pixel hits 
+     * are accumulated. The per collection options of the context (background energy threshold, 
+     * SimTrackerHit aggregation) apply if dest was given to MergeContext::beginCollection(). The caller has to call MergeContext::beginEvent() for the destination event 
+     * first and MergeContext::flush() once all merges into the event are done.
+     */
+    static void merge(EVENT::LCCollection* src, EVENT::LCCollection* dest, MergeKind kind, MergeContext* context = nullptr);
+
+
+    /** Moves a whole collection from srcEvent to destEvent, instead of merging its elements into a 
+     * new collection. The collection keeps its flag (not transient) and parameters. The source event 
+     * does not own it anymore and gets an empty collection of the same type instead, as left by the 
+     * element-wise merge. 
+     * Not done for LCGENERICOBJECT (FPCCD pixel hits), which need re-packing.<br>
+     *
+     * @param srcEvent source event.
+     * @param srcName name of the source collection, must exist in srcEvent
+     * @param destEvent destination event
+     * @param destName name of the destination collection, must not exist in destEvent
+     * @return whether the collection was moved
+     */
+    static bool adoptCollection(EVENT::LCEvent* srcEvent, const std::string& srcName, EVENT::LCEvent* destEvent, const std::string& destName);
         
+    /** Copies all collection parameters (string, int and float) from src to dest.
+     */
+    static void copyCollectionParameters(EVENT::LCCollection* src, EVENT::LCCollection* dest);
+
   protected:
     /** combines two 32 bit integers into a 64 bit long long of 
      * the form  {id0}{id1}.<br>
@@ -0,0 +1,118 @@
+#ifndef OccupancyMonitor_h
+#define OccupancyMonitor_h 1
+
+#include "lcio.h"
+#include <string>
+#include <vector>
+
+namespace EVENT{
+  class LCEvent ;
+}
+
+namespace overlay {
+
+  /**
+   *  @brief  OccupancyMonitor class
+   *
+   *  Counts the background hits overlaid per layer in a set of tracker collections, while they
+   *  are merged. At the end of each event the counts are written as event parameters, one integer
+   *  vector per collection (hits per layer), and accumulated for the end of job summary.
+   *  Collections not monitored have index -1: a disabled monitor costs one test per merge call.
+   */
+  class OccupancyMonitor {
+  public:
+    OccupancyMonitor() = default ;
+    OccupancyMonitor(const OccupancyMonitor&) = delete ;
+    OccupancyMonitor& operator =(const OccupancyMonitor&) = delete ;
+
+    /**
+     *  @brief  Set the monitored collections, resets all counts
+     *
+     *  @param  collectionNames the destination collection names
+     */
+    void setCollections( const EVENT::StringVec& collectionNames ) ;
+
+    /**
+     *  @brief  Whether any collection is monitored
+     */
+    bool enabled() const { return not _collections.empty() ; }
+
+    /**
+     *  @brief  Get the index of a monitored collection, -1 if not monitored
+     *
+     *  @param  collectionName the destination collection name
+     */
+    int index( const std::string& collectionName ) const ;
+
+    /**
+     *  @brief  Count a hit overlaid in a layer of a monitored collection
+     *
+     *  @param  collection the collection index, see index()
+     *  @param  layer the layer of the hit, negative layers are ignored
+     */
+    void add( int collection, long long layer ) {
+      if( layer < 0 ) {
+        return ;
+      }
+      std::vector<unsigned int>& counts = _collections[ collection ].counts ;
+      if( layer >= static_cast<long long>( counts.size() ) ) {
+        counts.resize( layer + 1, 0 ) ;
+      }
+      ++counts[ layer ] ;
+    }
+
+    /**
+     *  @brief  Write the counts of the event as event parameters, named <prefix><collection>,
+     *          accumulate them and reset them for the next event
+     *
+     *  @param  event the event
+     *  @param  prefix the parameter name prefix
+     */
+    void endEvent( EVENT::LCEvent* event, const std::string& prefix ) ;
+
+    /**
+     *  @brief  Get the number of layers seen in a monitored collection
+     *
+     *  @param  collection the collection index
+     */
+    unsigned int getNLayers( int collection ) const { return _collections[ collection ].sum.size() ; }
+
+    /**
+     *  @brief  Get the mean number of hits per event in a layer of a monitored collection
+     *
+     *  @param  collection the collection index
+     *  @param  layer the layer
+     */
+    double getMean( int collection, unsigned int layer ) const ;
+
+    /**
+     *  @brief  Get the RMS of the number of hits per event in a layer of a monitored collection
+     *
+     *  @param  collection the collection index
+     *  @param  layer the layer
+     */
+    double getRMS( int collection, unsigned int layer ) const ;
+
+    /**
+     *  @brief  Print the mean and RMS of the hits per layer of all monitored collections
+     */
+    void print() const ;
+
+  private:
+    /**
+     *  @brief  CollectionCounts struct. The counts of a monitored collection
+     */
+    struct CollectionCounts {
+      std::string                  name {} ;      ///< The destination collection name
+      std::vector<unsigned int>    counts {} ;    ///< The hits per layer in the current event
+      std::vector<double>          sum {} ;       ///< The sum over events of the hits per layer
+      std::vector<double>          sum2 {} ;      ///< The sum over events of the squared hits per layer
+    };
+
+    std::vector<CollectionCounts>  _collections {} ;   ///< The monitored collections
+    unsigned long                  _nEvents {0} ;      ///< The number of events
+  };
+
+} // namespace
+
+#endif
@@ -4,13 +4,20 @@
 #include "marlin/Processor.h"
 #include "marlin/EventModifier.h"
 #include "lcio.h"
+#include "AliasTable.h"
+#include "BackgroundFileRegistry.h"
+#include "MergePlan.h"
+#include "MergeContext.h"
+#include <map>
+#include <memory>
 #include <string>
 
 
 namespace overlay {
   
   /**
-   *  @brief  LCFileHandler class
+   *  @brief  LCFileHandler class. Handle on a background file shared with all other 
+   *          processors of the job through the BackgroundFileRegistry
    */
   class LCFileHandler {
   public:
@@ -52,21 +59,55 @@ namespace overlay {
      *  @param  eventNumber the event number of the event to read
      */
     EVENT::LCEvent* readEvent(int runNumber, int eventNumber);
-    
-  private:
+
+    /**
+     *  @brief  Read the event at the specified index of the event map. If the event directly 
+     *          follows the previously read one, it is streamed with readNextEvent() instead of 
+     *          a direct access seek
+     *  
+     *  @param  index the nth event to read
+     */
+    EVENT::LCEvent* readEventAt(unsigned int index);
+
+    /**
+     *  @brief  Open the LCIO file and build its run/event map, if not yet done.
+     *          Does not log, so that it can be called from worker threads
+     */
+    void index() const;
+
     /**
-     *  @brief  Proxy method to open the LCIO file
+     *  @brief  Get the LCIO file name
      */
-    void openFile() const;
+    const std::string& getFileName() const { return _file->getFileName() ; }
 
   private:
-    mutable std::shared_ptr<IO::LCReader>          _lcReader{}; ///< The LCIO file reader
-    mutable EVENT::IntVec                          _eventMap{}; ///< The run and event number 
-    std::string                                    _fileName{}; ///< The LCIO file name    
+    std::shared_ptr<BackgroundFile>                _file{};     ///< The shared background file
   };
   
   typedef std::vector<LCFileHandler> LCFileHandlerList;
 
+  /**
+   *  @brief  BackgroundSource struct. A named set of overlay input files,
+   *          with its own number of events to overlay and file sampling weights
+   */
+  struct BackgroundSource {
+    std::string                           name {} ;                   ///< The source name, empty for the default source
+    int                                   numOverlay {0} ;            ///< The fixed number of events to overlay
+    bool                                  poisson {false} ;           ///< Whether to add a poisson distributed number of events
+    double                                expBG {0.} ;                ///< The mean value of the poisson distribution
+    EVENT::StringVec                      fileNames {} ;              ///< The overlay input file names
+    std::vector<double>                   fileWeights {} ;            ///< The relative file weights, negative: use the number of events in the file
+    LCFileHandlerList                     fileHandlers {} ;           ///< The file handlers, one per input file
+    AliasTable                            fileTable {} ;              ///< The alias table to sample the input files
+    unsigned int                          nAvailableEvents {0} ;      ///< The total number of available events from the input files
+    int                                   nTotalOverlayEvents {0} ;   ///< The total number of events overlaid from this source
+    int                                   blockFile {-1} ;            ///< The file of the current sampling block, -1 if none
+    unsigned int                          blockNextIndex {0} ;        ///< The next event index in the current sampling block
+    int                                   blockRemaining {0} ;        ///< The number of events left in the current sampling block
+  };
+
+  typedef std::vector<BackgroundSource> BackgroundSourceList;
+
   /** Overlay processor allows to overlay an event with background events from 
    *  additional LCIO files based on different criteria.
    *
@@ -74,6 +115,9 @@ namespace overlay {
    *  with a number drawn from a poissonian distribution with a given mean 'expBG' (NumberOverlayEvents=0).
    *
    *  See Merger.cc for the collection types that can be merged.
+   *
+   *  Background files are opened and indexed once per job and shared with all other Overlay
+   *  processors reading the same files (see BackgroundFileRegistry).
    * 
    * @author N. Chiapolini, DESY
    * @author F. Gaede, DESY
@@ -95,6 +139,44 @@ namespace overlay {
    * @param ExcludeCollectionMap (StringVec) List of collection to exclude for merging. This is particularly useful when you just want to exclude a few collections.
    *                                   One doesn't have to specify all collections to overlay in the CollectionMap parameter minus the collection to avoid, 
    *                                   but just the ones to exclude. Priority is given to this list over the CollectionMap.                             
+   * @param BackgroundSources (StringVec) Additional named background sources overlaid by the same processor, each given as 
+   *                                   "name expBG file1 file2[:weight] ... ;". For each source a number of events is drawn from a Poisson
+   *                                   distribution with mean expBG and the files are sampled with a Walker alias table according to 
+   *                                   their weight (default: their number of events, i.e. uniform over all events of the source).
+   *                                   All sources share the same collection map, merge plans and physics event collection index.
+   *                                   If set, InputFileNames, NumberOverlayEvents and expBG are only used when InputFileNames is set explicitly.
+   * @param BlockSize (int)            Block sampling: instead of sampling every background event independently, pick a random event
+   *                                   and take it together with the following BlockSize-1 events of the same file (default 1, i.e. no blocks).
+   *                                   The events of a block are read sequentially (streamed) rather than with a direct access seek each, which
+   *                                   is much faster on compressed files. Blocks are cut at the end of a file and of a physics event, so that
+   *                                   the events overlaid only depend on the event seed.
+   *                                   Sampling statistics: every event is still used with (almost) the same probability, except that the
+   *                                   first BlockSize-1 events of each file are under-sampled. However the events overlaid on a physics event
+   *                                   come in runs of consecutive library events, so correlations in the library (e.g. ordered generator
+   *                                   output) are carried over, and the number of independent random draws is reduced by a factor BlockSize.
+   *                                   Use a library much larger than the number of overlaid events times BlockSize.
+   * @param IndexingThreads (int)      Number of threads used to open and index the input files of all sources at the first event.
+   *                                   Results are merged in file list order. Requires LCIO v2.13 or higher, serial otherwise. (default 1)
+   * @param TrackerHitPlaneMergePolicy (string) What to do with a background TrackerHitPlane hit in the same cell as a hit already
+   *                                   in the event: Keep (both, default), KeepFirst (drop the background hit) or Sum (charge summing).
+   *                                   Allows to overlay background digitised once, at digi level.
+   * @param TrackerHitPlaneMergeGrid (float) Position grid (mm) defining a cell within a TrackerHitPlane cellID, for sensors with a
+   *                                   cellID per sensor only. 0: the cell is given by the cellID alone. (default 0)
+   * @param ContributionCompaction (string) Compaction of the background MC contributions of SimCalorimeterHits (opt-in):
+   *                                   None (default), TimeBinned (one contribution per cell and time bin) or EnergyOnly (one per cell).
+   *                                   An aggregated contribution has the summed energy, the energy weighted time and the most energetic
+   *                                   particle. Contributions of the physics event are kept as they are.
+   * @param CompactionTimeBin (float)  Time bin width (ns) of the TimeBinned compaction (default 1)
+   * @param BackgroundEnergyThresholds (StringVec) Pairs of destination SimCalorimeterHit collection name and energy threshold (GeV).
+   *                                   Background energy below the threshold is dropped when merging, see EnergyThresholdMode.
+   *                                   Hits of the physics event are never dropped. (default none)
+   * @param EnergyThresholdMode (string) What the BackgroundEnergyThresholds are applied to: Contribution (each background MC
+   *                                   contribution, default) or CellSum (the energy sum of the cells created by the background,
+   *                                   after all background events are merged)
+   * @param SimTrackerHitCellMerging (StringVec) Pairs of destination SimTrackerHit collection name and position grid (mm). The background
+   *                                   hits of these collections are aggregated per cell (cellID and, if the grid is > 0, position grid cell):
+   *                                   the deposited energy is summed and the earliest time kept, the other properties are the ones of the first
+   *                                   hit. Hits of the physics event are kept as they are. (default none)
    */
   class Overlay final : public marlin::Processor, public marlin::EventModifier {
     // Deleted member functions : no copy
@@ -147,10 +229,37 @@ namespace overlay {
      */
     unsigned int getNAvailableEvents() const; 
 
+    /**
+     *  @brief  Open and index the input files of all sources, using IndexingThreads threads
+     */
+    void indexInputFiles() ;
+
+    /**
+     *  @brief  Parse the BackgroundSources parameter and add the sources to the source list
+     */
+    void parseBackgroundSources() ;
+
+    /**
+     *  @brief  Index the input files of the source and build its file alias table
+     *
+     *  @param  source the background source to prepare
+     */
+    void prepareSource( BackgroundSource& source ) const ;
+
     /** 
-     *  @brief  Helper method to randomly pick an event from available overlay input files 
+     *  @brief  Helper method to randomly pick an event from the input files of a background source
+     *
+     *  @param  source the background source to read from
+     */
+    LCEvent* readNextEvent( BackgroundSource& source ) ;
+
+    /**
+     *  @brief  Get the merge plan for the collections of the overlay event.
+     *          Plans are compiled once per distinct set of collection names and cached
+     *
+     *  @param  overlayEvent the overlay event to merge
      */
-    LCEvent* readNextEvent() ;
+    const MergePlan& getMergePlan( EVENT::LCEvent* overlayEvent ) ;
 
   private:
     // processor parameters
@@ -159,6 +268,16 @@ namespace overlay {
     int                                   _numOverlay {0} ;           ///< The additional number of events to overlay
     double                                _expBG {1} ;                ///< The mean value of the poisson distribution when randomly picking events
     EVENT::StringVec                      _excludeCollections {} ;    ///< The list of collection to exclude for overlay
+    EVENT::StringVec                      _backgroundSources {} ;     ///< The named background sources (see class description)
+    int                                   _nIndexingThreads {1} ;     ///< The number of threads used to index the input files
+    int                                   _blockSize {1} ;            ///< The number of consecutive events sampled at once
+    std::string                           _trackerHitPlanePolicy {"Keep"} ; ///< The duplicate cell policy for TrackerHitPlane hits
+    float                                 _trackerHitPlaneGrid {0.} ; ///< The position grid defining a TrackerHitPlane cell
+    std::string                           _compaction {"None"} ;      ///< The compaction mode of background SimCalorimeterHit contributions
+    float                                 _compactionTimeBin {1.} ;   ///< The time bin width of the time binned compaction
+    EVENT::StringVec                      _energyThresholds {} ;      ///< The background energy thresholds, (collection, threshold) pairs
+    std::string                           _thresholdMode {"Contribution"} ; ///< What the background energy thresholds are applied to
+    EVENT::StringVec                      _simTrackerHitCells {} ;    ///< The SimTrackerHit collections aggregated per cell, (collection, grid) pairs
     
     // internal members
     unsigned int                          _nAvailableEvents {0} ;     ///< The total number of available overlay events from input files
@@ -166,7 +285,10 @@ namespace overlay {
     int                                   _nRun {0} ;                 ///< The total number of processed runs
     int                                   _nEvt {0} ;                 ///< The total number of processed events
     int                                   _nTotalOverlayEvents {0} ;  ///< The total number of overlaid events when processor ends
-    LCFileHandlerList                     _lcFileHandlerList {} ;     ///< The list of file handler to manage overlay input files (see LCFileHandler class)
+    BackgroundSourceList                  _sources {} ;               ///< The background sources to overlay (see BackgroundSource struct)
+    std::map<EVENT::StringVec, MergePlan> _mergePlans {} ;            ///< The compiled merge plans, by overlay event collection names
+    CollectionIndex                       _destIndex {} ;             ///< The collection index of the current physics event
+    MergeContext                          _mergeContext {} ;          ///< The merge state (cell indices) of the current physics event
   } ;
 
 }
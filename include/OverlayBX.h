@@ -4,17 +4,15 @@
 #include "marlin/Processor.h"
 #include "marlin/EventModifier.h"
 #include "lcio.h"
+#include "BackgroundFileRegistry.h"
+#include "MergeContext.h"
+#include "OccupancyMonitor.h"
+#include <future>
+#include <memory>
 #include <string>
 #include <vector>
 
 
-#ifdef MARLIN_USE_AIDA
-#include <vector>
-#include <AIDA/AIDA.h>
-typedef std::vector< AIDA::IHistogram1D* > Hist1DVec ;
-#endif
-
-
 #include "CLHEP/Vector/TwoVector.h"
 
 namespace overlay{
@@ -38,6 +36,24 @@ namespace overlay{
   };
   typedef std::vector< VXDLayer >  VXDLayers ;
 
+  /** Helper struct for decoding one field of a cellID - offset and width resolved once from the encoding */
+  struct CellIDField{
+    unsigned offset ;
+    unsigned width ;
+    bool isSigned ;
+    CellIDField(): offset(0), width(64), isSigned(false) {}
+
+    /** resolve the field with the given index in the encoding string */
+    void init( const std::string& encoding , unsigned index ) ;
+
+    /** the field value of a cellID - cellID0 in the low, cellID1 in the high word */
+    long long operator()( unsigned long long cellID ) const {
+      // field moved to the top bits, then back: sign extended if signed
+      const unsigned long long top = cellID << ( 64 - offset - width ) ;
+      return isSigned ? ( (long long) top >> ( 64 - width ) ) : (long long) ( top >> ( 64 - width ) ) ;
+    }
+  };
+
 
   // /** Helper struct for TPC parameters */
   // struct TPCParameters{ };
@@ -51,7 +67,8 @@ namespace overlay{
    *  No shift in  r-phi (along the ladders) is applied for the VXD so far.
    *  For all other detectors high time resolution is assumed and only one bunch crosing will be overalayd.<br>
    *  <b>Note: code assumes that background files contain exactly one bunch crossing - this is necesassary as 
-   *     guineapig files are ordered.</b>
+   *     guineapig files are ordered.</b><br>
+   *  Only the collections merged for a BX are read from the background files, unless keepPairsMCPinfo is set.
    * 
    *  @author F. Gaede DESY (based on Overlay processor by N. Chiapolini)
    *  @version $Id$
@@ -88,7 +105,31 @@ namespace overlay{
    * 
    *  @param MaxNumberOfEventsPerFile (int) 
    *  Maximum number of background events to be read from one file. Default: -1, i.e. read one file per BX.
-   *  This option is essentially for testing. 
+   *  Otherwise a file holds several BXs of MaxNumberOfEventsPerFile consecutive events each, read in turn
+   *  every time the file is drawn. This option is essentially for testing. 
+   *
+   *  @param MaxOpenFiles (int) Maximum number of background files kept open (and indexed) between BXs, the least 
+   *  recently used file is closed first. The idle readers kept for ReadAheadBXs count as open files. Default: 64.
+   *  Limited to half the open file limit of the process (getrlimit), which is also used for 0 or negative values.
+   *
+   *  @param ReadAheadBXs (int) Number of BXs read ahead by worker threads while the current BX is merged. The 
+   *  files of all BXs of an event are drawn first, the files of the next BXs are then opened and indexed and their first 
+   *  background event is read concurrently, each with a reader of its own. BXs are still merged in order, the output is 
+   *  unchanged. Reduced to MaxOpenFiles/2-1, the BX merged and each BX read ahead holding a file and a reader.
+   *  Default: 0, i.e. read the BXs one after the other. Ignored with PhiRotateTPCHits, which draws random numbers 
+   *  while merging, and requires LCIO v2.13 or higher.
+   *
+   *  @param OccupancyCollections (StringVec) VXD and TPC (output) collections for which the overlaid background 
+   *  hits are counted per layer while merging. The counts are written as event parameters 
+   *  <processor name>_nBgHits_<collection> (hits per layer) and summarised at the end of the job. Default: none.
+   *
+   *  @param TPCTemplateMode (string) None (default): the TPC background is overlaid from the BX files. 
+   *  Generate: the TPC background of all BXs of each event, shifted in z and clipped to the drift volume, is written 
+   *  to TPCTemplateFiles as one template event (collections named as the TPC output collections) instead of being 
+   *  overlaid; no phi rotation is applied. Consume: one random template event is overlaid per event, rotated with 
+   *  PhiRotateTPCHits, and no BX file is read for the TPC.
+   *
+   *  @param TPCTemplateFiles (StringVec) The template file to write (Generate) or the template files to read (Consume).
    */
 
   class OverlayBX : public marlin::Processor, public marlin::EventModifier {
@@ -121,9 +162,6 @@ namespace overlay{
     //  virtual void processEvent( LCEvent * evt ) ; 
   
   
-    virtual void check( LCEvent * evt ) ; 
-  
-  
     /** Called after data processing for clean up.
      */
     virtual void end() ;
@@ -137,12 +175,50 @@ namespace overlay{
     /** helper function for reading the next event of BX bxNum */
     LCEvent*  readNextEvent(int bxNum) ;
 
+    /** helper function: the background file iFile from the reader pool, opened if needed */
+    BackgroundFile& openBXFile(int iFile) ;
+
+    /** helper function: close the least recently used files but keepFile until nNeeded more files can be opened */
+    void closeBXFiles(int nNeeded, int keepFile) ;
+
+    /** A BX read ahead: file drawn, events to read and the reader used for them */
+    struct BXLoad {
+      int iFile = -1 ;                          // index of the drawn file
+      std::shared_ptr<BackgroundFile> file{} ;  // the drawn file, kept open until the BX is merged
+      unsigned int firstEvent = 0 ;             // first event of the BX in the file event map
+      unsigned int endEvent = 0 ;               // one past the last event of the BX
+      std::unique_ptr<IO::LCReader> reader{} ;  // reader of this BX only, its events stay valid while others are read
+      LCEvent* event = 0 ;                      // first event of the BX, read by a worker thread
+      StringVec collections{} ;                 // collections read for the BX, all if empty
+    };
+
+    /** helper function: overlay one random TPC template, returns the number of hits */
+    int mergeTPCTemplate( LCEvent* evt ) ;
+
+    /** helper function: the background collections merged for BX bxNum, empty to read all collections */
+    void bxCollectionNames(int bxNum, int nVXDBX, int nTPCBX, StringVec& names) const ;
+
+    /** helper function: draw the files of the numBX BXs of the event, in BX order */
+    void planBXLoads(int numBX) ;
+
+    /** helper function: open and index the files of BXs firstBX to endBX-1 drawn by planBXLoads(), in BX order */
+    void prepareBXLoads(int firstBX, int endBX) ;
+
+    /** helper function: start reading the first event of BX bxNum on a worker thread */
+    std::future<void> startBXLoad(int bxNum) ;
+
+    /** helper function: event iEvt of a BX read ahead, 0 past its last event */
+    LCEvent* readBXEvent(BXLoad& load, long iEvt) ;
+
+    /** helper function: give back the reader of a merged BX */
+    void releaseBXLoad(BXLoad& load) ;
+
     /** helper function */
     void init_geometry() ;
     /** helper function */
-    int mergeVXDColsFromBX( LCCollection* vxdCol , LCCollection* vxdBGCol , int bxNum )  ;
+    int mergeVXDColsFromBX( LCCollection* vxdCol , LCCollection* vxdBGCol , int bxNum , int monitorIndex )  ;
     /** helper function */
-    int mergeTPCColsFromBX( LCCollection* tpcCol , LCCollection* tpcBGCol , float zPosShift ) ;
+    int mergeTPCColsFromBX( LCCollection* tpcCol , LCCollection* tpcBGCol , float zPosShift , int monitorIndex ) ;
 
     // ---- variables for processor parameters ----- 
     StringVec   _inputFileNames{};
@@ -164,27 +240,64 @@ namespace overlay{
     std::string _vxdCollection = "";
     StringVec   _mergeCollections{};
     int         _ranSeed = 42;
+    int         _readAheadBXs = 0;
+    StringVec   _occupancyCollections{};
+    std::string _tpcTemplateModeName = "None";
+    StringVec   _tpcTemplateFiles{};
 
     //---- class member variables ------
     typedef std::map<std::string, std::string> StrMap ;
     StrMap _tpcMap{};
     StrMap _colMap{};
+    MergeContext _mergeContext{};   // merge state (cell indices) of the current event, shared by all BXs
     //  std::map<std::string, std::string> _colMap;
 
-    std::vector< LCReader* > _lcReaders{};
+    /** A background file of the reader pool */
+    struct BXFile {
+      std::shared_ptr<BackgroundFile> file{} ;  // the open file (direct access reader and event index), null if closed
+      unsigned int nextEvent = 0 ;              // first event of the next BX read from this file
+      unsigned long lastUse = 0 ;               // for closing the least recently used file
+      int nLoads = 0 ;                          // number of BXs read ahead from this file, not closed while > 0
+      std::vector< std::unique_ptr<IO::LCReader> > readers{} ;  // idle readers for BXs read ahead
+    };
+
+    std::vector< BXFile > _bxFiles{};
+    std::vector< BXLoad > _bxLoads{};
+    double _tpcHalfLength = 0.;
+    std::vector< double > _tpcX{};               // TPC hit positions of the BX merged, structure of arrays
+    std::vector< double > _tpcY{};
+    std::vector< double > _tpcZ{};
+    std::vector< unsigned char > _tpcAccept{};   // whether the TPC hit is in the drift volume after the z shift
+    int _maxOpenFiles = 64;
+    int _nOpenFiles = 0;
+    unsigned long _nFileOpens = 0;
+    unsigned long _nFileUses = 0;
+    unsigned long _nBXsRead = 0;
+    unsigned int _bxFirstEvent = 0;
+    StringVec _bxReadCollections{};
     //int _maxBXs ;
     int _nRun = 0;
     int _nEvt = 0;
     //  VXDLadders _vxdLadders ;
     VXDLayers  _vxdLayers{};
+    CellIDField _trackerLayerField{};              // layer field of the tracker cellIDs (LCTrackerCellID)
+    std::vector< long long > _vxdHitLayers{};      // layers of the VXD hits of the BX merged
+    std::vector< unsigned char > _vxdLayerAccept{};  // whether a layer overlays the BX merged
 
     int _lastBXNum = -1;
     int _lastEvent = -1;
     int _currentRdr = -1;
-  
-#ifdef MARLIN_USE_AIDA
-    Hist1DVec _hist1DVec{};
-#endif
+
+    OccupancyMonitor _occupancy{};   // background hits per layer, for the OccupancyCollections
+
+    /** What the TPC templates are used for */
+    enum TPCTemplateMode { kNoTPCTemplates = 0 , kGenerateTPCTemplates , kConsumeTPCTemplates } ;
+
+    TPCTemplateMode _tpcTemplateMode = kNoTPCTemplates;
+    std::unique_ptr<IO::LCWriter> _tpcTemplateWriter{};                  // output of the Generate mode
+    std::vector< std::shared_ptr<BackgroundFile> > _tpcTemplateInputs{};  // inputs of the Consume mode
+    StringVec _tpcDestNames{};                                           // the TPC output collections
+    unsigned long _nTPCTemplates = 0;                                    // templates written or overlaid
 
   } ;
 
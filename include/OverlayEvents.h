@@ -4,8 +4,10 @@
 #include "marlin/Processor.h"
 #include "marlin/EventModifier.h"
 #include "lcio.h"
+#include <map>
 #include <string>
 #include <IMPL/LCEventImpl.h>
+#include "MergeContext.h"
 
 #include "IO/LCWriter.h"
 
@@ -60,6 +62,8 @@ namespace overlay {
     LCEventImpl* outEvt = NULL;
   
     StringVec _mergedCollectionNames{};
+    std::map<std::string, std::string> _mergedCollectionMap{};
+    MergeContext _mergeContext{};
   
     LCWriter* _lcWriter{};
   
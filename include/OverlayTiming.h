@@ -5,17 +5,26 @@
 #include "marlin/EventModifier.h"
 
 #include "lcio.h"
+#include "ContributionCompactor.h"
+#include "EnergyThresholdFilter.h"
+#include "MergeContext.h"
 
 #include <cmath>
 #include <limits>
 
 namespace EVENT{
+  class MCParticle;
   class SimCalorimeterHit;
   class LCRunHeader;
   class LCEvent;
   class LCCollection;
 }
 
+namespace IMPL{
+  class SimCalorimeterHitImpl;
+  class SimTrackerHitImpl;
+}
+
 namespace overlay {
 
   /** OverlayTiming processor for overlaying background to each bunch crossing of a bunch train.
@@ -49,6 +58,24 @@ namespace overlay {
    *  @param RandomBx - default false -- Put the physics event at a random number of the bunch train
    *
    *  @param RandomSeed (int) random seed - default 42
+   *
+   *  @param ContributionCompaction (string) - default None -- Compaction of the background MC contributions of SimCalorimeterHits:
+   *  None, TimeBinned (one contribution per cell and time bin) or EnergyOnly (one contribution per cell). 
+   *  An aggregated contribution has the summed energy, the energy weighted time and the most energetic particle.
+   *
+   *  @param CompactionTimeBin [ns] (float) - default 1 -- Time bin width for the TimeBinned compaction
+   *
+   *  @param BackgroundEnergyThresholds (StringVec) - default none -- Pairs of SimCalorimeterHit collection name and energy threshold [GeV].
+   *  Background energy below the threshold is not merged, see EnergyThresholdMode. Hits of the physics event are never dropped.
+   *
+   *  @param EnergyThresholdMode (string) - default Contribution -- What the BackgroundEnergyThresholds are applied to: 
+   *  Contribution (each background MC contribution in the time window) or CellSum (the energy sum of the cells created by the background, 
+   *  after the whole bunch train is merged)
+   *
+   *  @param SimTrackerHitCellMerging (StringVec) - default none -- Pairs of SimTrackerHit collection name and position grid [mm].
+   *  The background hits of these collections in the time window are aggregated per cell (cellID and, if the grid is > 0, position grid cell):
+   *  the deposited energy is summed and the earliest time kept, the other properties are the ones of the first hit. Hits of the physics event
+   *  are kept as they are.
    * 
    */
   class OverlayTiming : public marlin::Processor, public marlin::EventModifier
@@ -84,6 +111,18 @@ namespace overlay {
 
     unsigned long long cellID2long(unsigned int id0, unsigned int id1) const;
 
+    /** Registers the parameters of the background merging (compaction, ...), shared with derived processors */
+    void register_merge_parameters();
+
+    /** Sets up the background merging from its parameters, to be called in init() */
+    void init_merge_options();
+
+    /** Adds a background contribution to a hit, compacted if configured. The energy threshold is applied by the caller */
+    void add_contribution(IMPL::SimCalorimeterHitImpl *hit, EVENT::MCParticle *particle, float energy, float time);
+
+    /** Adds a background tracker hit to the destination collection, or sums it into the background hit of its cell (grid >= 0) and deletes it */
+    void add_tracker_hit(EVENT::LCCollection *dest_collection, IMPL::SimTrackerHitImpl *hit, double grid);
+
     float _T_diff = 0.5;
     int _nBunchTrain = 1;
 
@@ -146,9 +185,30 @@ namespace overlay {
     float _tpcVdrift_mm_ns = 5.0e-2 ;
     bool _randomBX = false, _Poisson = false;
 
+    std::string _compaction = "None";
+    float _compactionTimeBin = 1.;
+    ContributionCompactor _compactor{};
+
+    StringVec _energyThresholds{};
+    std::string _thresholdMode = "Contribution";
+    EnergyThresholdFilter _energyFilter{};
+
+    StringVec _simTrackerHitCells{};
+    std::map<std::string, float> _simTrackerHitCellGrids{};
+
+    // allocation counters, printed at end()
+    unsigned long _nCreatedCalorimeterHits = 0;
+    unsigned long _nCroppedCalorimeterHits = 0;
+    unsigned long _nSkippedCalorimeterHits = 0;
+    unsigned long _nAggregatedTrackerHits = 0;
+
     typedef std::map<unsigned long long, EVENT::SimCalorimeterHit*> DestMap;
     typedef std::map<std::string, DestMap> CollDestMap;
     CollDestMap collDestMap{};
+
+    typedef std::map<std::pair<unsigned long long, long long>, EVENT::SimTrackerHit*> TrackerDestMap;
+    typedef std::map<EVENT::LCCollection*, TrackerDestMap> CollTrackerDestMap;
+    CollTrackerDestMap collTrackerDestMap{};
   };
 
   //------------------------------------------------------------------------------------------------------------------------------------------
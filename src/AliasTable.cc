@@ -0,0 +1,66 @@
+#include "AliasTable.h"
+
+namespace overlay {
+
+  void AliasTable::build( const std::vector<double>& weights ) {
+    _probabilities.clear() ;
+    _aliases.clear() ;
+
+    const unsigned int n = weights.size() ;
+    double sum(0.) ;
+
+    for ( auto weight : weights ) {
+      sum += ( weight > 0. ? weight : 0. ) ;
+    }
+
+    if( 0 == n || sum <= 0. ) {
+      return ;
+    }
+
+    _probabilities.resize( n ) ;
+    _aliases.resize( n ) ;
+
+    // scaled probabilities, mean 1
+    std::vector<double> scaled( n ) ;
+    std::vector<unsigned int> small, large ;
+
+    for ( unsigned int i=0 ; i<n ; i++ ) {
+      scaled[i] = ( weights[i] > 0. ? weights[i] : 0. ) * n / sum ;
+      _aliases[i] = i ;
+      ( scaled[i] < 1. ? small : large ).push_back( i ) ;
+    }
+
+    while( not small.empty() && not large.empty() ) {
+      const unsigned int s = small.back() ; small.pop_back() ;
+      const unsigned int l = large.back() ; large.pop_back() ;
+
+      _probabilities[s] = scaled[s] ;
+      _aliases[s] = l ;
+
+      scaled[l] = ( scaled[l] + scaled[s] ) - 1. ;
+      ( scaled[l] < 1. ? small : large ).push_back( l ) ;
+    }
+
+    // left overs are 1 up to rounding errors
+    for ( auto i : large ) {
+      _probabilities[i] = 1. ;
+    }
+    for ( auto i : small ) {
+      _probabilities[i] = 1. ;
+    }
+  }
+
+  //===========================================================================================================================
+
+  unsigned int AliasTable::sample( double flat ) const {
+    const double scaled = flat * _probabilities.size() ;
+    unsigned int column = static_cast<unsigned int>( scaled ) ;
+
+    if( column >= _probabilities.size() ) {
+      column = _probabilities.size() - 1 ;
+    }
+
+    return ( scaled - column < _probabilities[column] ) ? column : _aliases[column] ;
+  }
+
+} // namespace
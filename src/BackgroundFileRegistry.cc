@@ -0,0 +1,148 @@
+#include "BackgroundFileRegistry.h"
+
+#include "EVENT/LCEvent.h"
+#include "IO/LCReader.h"
+#include "IOIMPL/LCFactory.h"
+
+#include "streamlog/streamlog.h"
+
+using namespace lcio ;
+
+namespace overlay {
+
+  BackgroundFile::BackgroundFile( const std::string& fileName ) :
+    _fileName( fileName ) {
+  }
+
+  //===========================================================================================================================
+
+  BackgroundFile::~BackgroundFile() {
+    if( nullptr != _lcReader ) {
+      _lcReader->close() ;
+    }
+  }
+
+  //===========================================================================================================================
+
+  void BackgroundFile::index() {
+    std::lock_guard<std::mutex> lock( _mutex ) ;
+
+    if( not _isOpen.load( std::memory_order_relaxed ) ) {
+      _lcReader.reset( LCFactory::getInstance()->createLCReader( LCReader::directAccess ) ) ;
+      _lcReader->open( _fileName ) ;
+      _lcReader->getEvents( _eventMap ) ;
+      // publishes the reader and the event map to openFile()
+      _isOpen.store( true, std::memory_order_release ) ;
+    }
+  }
+
+  //===========================================================================================================================
+
+  void BackgroundFile::openFile() {
+    if( not _isOpen.load( std::memory_order_acquire ) ) {
+      streamlog_out( MESSAGE ) << "*** Opening file for overlay, file name:" << _fileName << std::endl ;
+
+      index() ;
+
+      streamlog_out( MESSAGE ) << "*** Opening file for overlay : number of available events: " << getNumberOfEvents() << std::endl ;
+    }
+  }
+
+  //===========================================================================================================================
+
+  unsigned int BackgroundFile::getNumberOfEvents() {
+    openFile() ;
+    return _eventMap.size() / 2 ;
+  }
+
+  //===========================================================================================================================
+
+  unsigned int BackgroundFile::getEventNumber( unsigned int index ) {
+    openFile() ;
+    return _eventMap.at( index * 2 + 1 ) ;
+  }
+
+  //===========================================================================================================================
+
+  unsigned int BackgroundFile::getRunNumber( unsigned int index ) {
+    openFile() ;
+    return _eventMap.at( index * 2 ) ;
+  }
+
+  //===========================================================================================================================
+
+  void BackgroundFile::setReadCollectionNames( const EVENT::StringVec* collectionNames ) {
+    static const EVENT::StringVec allCollections ;
+    const EVENT::StringVec& names = ( nullptr != collectionNames ) ? *collectionNames : allCollections ;
+
+    // the reader is shared: every read states its collections
+    if( names != _readCollectionNames ) {
+      _lcReader->setReadCollectionNames( names ) ;
+      _readCollectionNames = names ;
+    }
+  }
+
+  //===========================================================================================================================
+
+  EVENT::LCEvent* BackgroundFile::readEvent( int runNumber, int eventNumber, const EVENT::StringVec* collectionNames ) {
+    openFile() ;
+    setReadCollectionNames( collectionNames ) ;
+    streamlog_out( DEBUG6 ) << "*** Reading event from file : '" << _fileName
+          << "',  event number " << eventNumber << " of run " << runNumber << "." << std::endl ;
+    _nextIndex = 0 ;
+    return _lcReader->readEvent( runNumber, eventNumber, LCIO::UPDATE ) ;
+  }
+
+  //===========================================================================================================================
+
+  EVENT::LCEvent* BackgroundFile::readEventAt( unsigned int index, const EVENT::StringVec* collectionNames ) {
+    openFile() ;
+    setReadCollectionNames( collectionNames ) ;
+    const int runNumber = getRunNumber( index ) ;
+    const int eventNumber = getEventNumber( index ) ;
+    EVENT::LCEvent* event = nullptr ;
+
+    // the position is shared by all users of the file: only stream if nobody read in between
+    if( index > 0 && index == _nextIndex ) {
+      streamlog_out( DEBUG6 ) << "*** Streaming next event from file : '" << _fileName
+            << "',  event number " << eventNumber << " of run " << runNumber << "." << std::endl ;
+      event = _lcReader->readNextEvent( LCIO::UPDATE ) ;
+
+      // the event map is sorted by run and event number, which might not be the file order
+      if( nullptr != event && ( event->getRunNumber() != runNumber || event->getEventNumber() != eventNumber ) ) {
+        event = nullptr ;
+      }
+    }
+
+    if( nullptr == event ) {
+      event = readEvent( runNumber, eventNumber, collectionNames ) ;
+    }
+
+    _nextIndex = index + 1 ;
+    return event ;
+  }
+
+  //===========================================================================================================================
+  //===========================================================================================================================
+
+  BackgroundFileRegistry& BackgroundFileRegistry::instance() {
+    static BackgroundFileRegistry registry ;
+    return registry ;
+  }
+
+  //===========================================================================================================================
+
+  std::shared_ptr<BackgroundFile> BackgroundFileRegistry::acquire( const std::string& fileName ) {
+    std::lock_guard<std::mutex> lock( _mutex ) ;
+
+    std::shared_ptr<BackgroundFile> file = _files[ fileName ].lock() ;
+
+    if( nullptr == file ) {
+      file = std::make_shared<BackgroundFile>( fileName ) ;
+      _files[ fileName ] = file ;
+    }
+
+    return file ;
+  }
+
+} // namespace
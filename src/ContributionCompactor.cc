@@ -0,0 +1,88 @@
+#include "ContributionCompactor.h"
+
+#include <EVENT/MCParticle.h>
+#include <IMPL/SimCalorimeterHitImpl.h>
+
+#include <cmath>
+
+namespace overlay {
+
+  bool compactionModeFromString( const std::string& name, CompactionMode& mode ) {
+    if( "None" == name )       { mode = kNoCompaction ;          return true ; }
+    if( "TimeBinned" == name ) { mode = kTimeBinnedCompaction ;  return true ; }
+    if( "EnergyOnly" == name ) { mode = kEnergyOnlyCompaction ;  return true ; }
+    return false ;
+  }
+
+  //===========================================================================================================================
+  //===========================================================================================================================
+
+  void ContributionCompactor::setMode( CompactionMode mode, float timeBin ) {
+    _mode = mode ;
+    _timeBin = ( timeBin > 0. ) ? timeBin : 1. ;
+  }
+
+  //===========================================================================================================================
+
+  void ContributionCompactor::add( IMPL::SimCalorimeterHitImpl* hit, EVENT::MCParticle* particle, float energy, float time ) {
+    ++_nAdded ;
+
+    const long long index = ( kTimeBinnedCompaction == _mode ) ? static_cast<long long>( std::floor( time / _timeBin ) ) : 0 ;
+
+    auto iter = _bins.find( hit ) ;
+
+    if( _bins.end() == iter ) {
+      iter = _bins.emplace( hit, std::vector<Bin>() ).first ;
+      _hits.push_back( hit ) ;
+    }
+
+    // a few bins per hit at most: linear search
+    std::vector<Bin>& bins = iter->second ;
+    Bin* bin = nullptr ;
+
+    for( auto& b : bins ) {
+      if( b.index == index ) {
+        bin = &b ;
+        break ;
+      }
+    }
+
+    if( nullptr == bin ) {
+      bins.push_back( Bin() ) ;
+      bin = &bins.back() ;
+      bin->index = index ;
+      bin->particle = particle ;
+      bin->maxEnergy = energy ;
+      bin->firstTime = time ;
+    }
+    else if( energy > bin->maxEnergy ) {
+      bin->particle = particle ;
+      bin->maxEnergy = energy ;
+    }
+
+    bin->energy += energy ;
+    bin->energyTime += energy * time ;
+  }
+
+  //===========================================================================================================================
+
+  void ContributionCompactor::flush() {
+    for( auto hit : _hits ) {
+      for( const auto& bin : _bins[ hit ] ) {
+        const float time = ( bin.energy > 0. ) ? bin.energyTime / bin.energy : bin.firstTime ;
+        hit->addMCParticleContribution( bin.particle, bin.energy, time ) ;
+        ++_nWritten ;
+      }
+    }
+
+    clear() ;
+  }
+
+  //===========================================================================================================================
+
+  void ContributionCompactor::clear() {
+    _bins.clear() ;
+    _hits.clear() ;
+  }
+
+} // namespace
@@ -0,0 +1,144 @@
+#include "EnergyThresholdFilter.h"
+
+#include <EVENT/LCCollection.h>
+#include <EVENT/SimCalorimeterHit.h>
+#include <IMPL/LCCollectionVec.h>
+#include <IMPL/SimCalorimeterHitImpl.h>
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace overlay {
+
+  bool thresholdModeFromString( const std::string& name, ThresholdMode& mode ) {
+    if( "Contribution" == name ) { mode = kContributionThreshold ;  return true ; }
+    if( "CellSum" == name )      { mode = kCellSumThreshold ;       return true ; }
+    return false ;
+  }
+
+  //===========================================================================================================================
+  //===========================================================================================================================
+
+  void EnergyThresholdFilter::setThresholds( const std::map<std::string, float>& thresholds, ThresholdMode mode ) {
+    _thresholds.clear() ;
+    _mode = mode ;
+
+    // a threshold <= 0 keeps everything
+    for( const auto& iter : thresholds ) {
+      if( iter.second > 0. ) {
+        _thresholds.insert( iter ) ;
+      }
+    }
+
+    clear() ;
+  }
+
+  //===========================================================================================================================
+
+  float EnergyThresholdFilter::threshold( const std::string& collectionName ) const {
+    auto iter = _thresholds.find( collectionName ) ;
+    return ( _thresholds.end() == iter ) ? 0. : iter->second ;
+  }
+
+  //===========================================================================================================================
+
+  void EnergyThresholdFilter::beginCollection( EVENT::LCCollection* collection, const std::string& collectionName ) {
+    _collection = collection ;
+    _threshold = threshold( collectionName ) ;
+  }
+
+  //===========================================================================================================================
+
+  int EnergyThresholdFilter::select( const EVENT::SimCalorimeterHit* hit ) {
+    const int nContributions = hit->getNMCContributions() ;
+
+    _energies.resize( nContributions ) ;
+    _selected.resize( nContributions ) ;
+
+    // gather first: the getters are virtual
+    for( int j=0 ; j<nContributions ; j++ ) {
+      _energies[j] = hit->getEnergyCont(j) ;
+    }
+
+    // branch free, vectorisable
+    const float* energies = _energies.data() ;
+    unsigned char* selected = _selected.data() ;
+    const float threshold = _threshold ;
+    int nSelected = 0 ;
+
+    for( int j=0 ; j<nContributions ; j++ ) {
+      selected[j] = ( energies[j] >= threshold ) ;
+      nSelected += selected[j] ;
+    }
+
+    return nSelected ;
+  }
+
+  //===========================================================================================================================
+
+  void EnergyThresholdFilter::watch( IMPL::SimCalorimeterHitImpl* hit ) {
+    if( kCellSumThreshold != _mode || not active() ) {
+      return ;
+    }
+
+    WatchedCell cell ;
+    cell.collection = _collection ;
+    cell.hit = hit ;
+    cell.threshold = _threshold ;
+    _watched.push_back( cell ) ;
+  }
+
+  //===========================================================================================================================
+
+  unsigned int EnergyThresholdFilter::flush() {
+    std::unordered_set<EVENT::LCObject*> dropped ;
+    std::vector<EVENT::LCCollection*> collections ;
+
+    for( const auto& cell : _watched ) {
+      const float energy = cell.hit->getEnergy() ;
+
+      if( energy >= cell.threshold || not dropped.insert( cell.hit ).second ) {
+        continue ;
+      }
+
+      ++_nRejectedCells ;
+      _rejectedCellEnergy += energy ;
+
+      if( collections.end() == std::find( collections.begin(), collections.end(), cell.collection ) ) {
+        collections.push_back( cell.collection ) ;
+      }
+    }
+
+    // a single pass per collection
+    for( auto collection : collections ) {
+      IMPL::LCCollectionVec* vec = dynamic_cast<IMPL::LCCollectionVec*>( collection ) ;
+
+      if( nullptr != vec ) {
+        vec->erase( std::remove_if( vec->begin(), vec->end(), [&dropped]( EVENT::LCObject* object ) { return dropped.count( object ) > 0 ; } ), vec->end() ) ;
+        continue ;
+      }
+
+      for( int i=collection->getNumberOfElements()-1 ; i>=0 ; i-- ) {
+        if( dropped.count( collection->getElementAt(i) ) > 0 ) {
+          collection->removeElementAt(i) ;
+        }
+      }
+    }
+
+    for( auto object : dropped ) {
+      delete object ;
+    }
+
+    _watched.clear() ;
+    return dropped.size() ;
+  }
+
+  //===========================================================================================================================
+
+  void EnergyThresholdFilter::clear() {
+    _collection = nullptr ;
+    _threshold = 0. ;
+    _watched.clear() ;
+  }
+
+} // namespace
@@ -1,7 +1,9 @@
 #define BGNAME "expBG"
 
 #include "FPCCDOverlayBX.h"
+#include <algorithm>
 #include <iostream>
+#include <numeric>
 
 #ifdef MARLIN_USE_AIDA
 #include <marlin/AIDAProcessor.h>
@@ -12,7 +14,9 @@
 
 #include <EVENT/LCCollection.h>
 #include <IMPL/LCCollectionVec.h>
+#include <IMPL/LCEventImpl.h>
 #include "IO/LCReader.h"
+#include "IO/LCWriter.h"
 //#include <EVENT/SimTrackerHit.h>
 #include <IMPL/SimTrackerHitImpl.h>
 #include <IMPL/LCGenericObjectImpl.h>
@@ -21,8 +25,11 @@
 #include "Merger.h"
 #include "FPCCDData.h"
 #include "FPCCDPixelHit.h"
+#include "BackgroundFileRegistry.h"
 
 #include <marlin/Global.h>
+#include "marlin/ProcessorEventSeeder.h"
+#include "CLHEP/Random/RandFlat.h"
 #include <gear/GEAR.h>
 #include <gear/VXDParameters.h>
 #include <gear/VXDLayerLayout.h>
@@ -65,6 +72,27 @@ namespace overlay {
 				"Number of  bunch crossings [s] - default 100" ,
 				_numBX ,
 				int(100) ) ;
+
+    registerProcessorParameter( "PixelThreads" ,
+				"Number of threads summing the pixel hits of a BX, ladder by ladder - default 1" ,
+				_nPixelThreads ,
+				int(1) ) ;
+
+    registerProcessorParameter( "FrameMode" ,
+				"None: overlay NumberOfBunchCrossings background files per event, Generate: write pre-summed readout frames"
+				" in init, Consume: overlay a random readout frame per event - default None" ,
+				_frameModeName ,
+				std::string("None") ) ;
+
+    registerOptionalParameter( "FrameFiles" , 
+			       "Readout frame file to write (Generate) or files to read (Consume)"  ,
+			       _frameFiles ,
+			       StringVec() ) ;
+
+    registerProcessorParameter( "NumberOfFrames" ,
+				"Number of readout frames to generate - default -1, i.e. as many as the background files allow" ,
+				_nFrames ,
+				int(-1) ) ;
     
     registerProcessorParameter( "VXDCollection" , 
 				"collection of VXD SimTrackerHits" ,
@@ -126,6 +154,42 @@ namespace overlay {
       streamlog_out( DEBUG ) << "    " << *it << std::endl ;
     
     }
+
+    //-----  readout frames  ----------
+    if( _frameModeName == "None" ) {
+      _frameMode = kNoFrames ;
+    } else if( _frameModeName == "Generate" ) {
+      _frameMode = kGenerateFrames ;
+    } else if( _frameModeName == "Consume" ) {
+      _frameMode = kConsumeFrames ;
+    } else {
+      throw Exception( "FPCCDOverlayBX::init: invalid FrameMode " + _frameModeName + ", must be None, Generate or Consume" ) ;
+    }
+
+    if( _frameMode != kNoFrames && _frameFiles.empty() ) {
+      throw Exception( "FPCCDOverlayBX::init: FrameFiles must be given with FrameMode " + _frameModeName ) ;
+    }
+
+    _frameInputs.clear() ;
+
+    if( _frameMode == kConsumeFrames ) {
+      for( const auto& fileName : _frameFiles ) 
+	_frameInputs.push_back( BackgroundFileRegistry::instance().acquire( fileName ) ) ;
+
+      // the frames are drawn at random
+      Global::EVENTSEEDER->registerProcessor(this);
+    }
+
+    // the VXD geometry does not change during the job
+    init_geometry();
+
+    _pixelAccumulator.init( _nLayer , _maxLadder , std::max( 1 , _nPixelThreads ) ) ;
+
+    _currentRdr = -1 ;
+    _lastBXNum = -1 ;
+
+    if( _frameMode == kGenerateFrames ) 
+      generateFrames() ;
   
 
     _nRun = 0 ;
@@ -139,47 +203,57 @@ namespace overlay {
     _nRun++ ;
   } 
 
-  LCEvent* FPCCDOverlayBX::readNextEvent( int bxNum ){
+  void FPCCDOverlayBX::resetFileQueue(){
+
+    // files are taken from the back: the last input file is read first
+    _fileQueue.resize( _inputFileNames.size() ) ;
+    std::iota( _fileQueue.begin() , _fileQueue.end() , 0u ) ;
+  }
+
+
+  void FPCCDOverlayBX::closeCurrentReader(){
+
+    if( _currentRdr != -1 ) {
+
+      _lcReaders[_currentRdr]->close() ; 
+
+      streamlog_out( DEBUG4 ) << " >>>> closing reader " << _currentRdr 
+			      << " , " << _fileQueue.size() << " files left" << std::endl ;
+    }
+
+    _currentRdr = -1 ;
+    _lastBXNum = -1 ;
+  }
 
-    static int lastBXNum = -1 ; // fixme: make this a class variable....
-    static int lastEvent = -1 ; 
-    static int currentRdr = -1 ;
 
+  LCEvent* FPCCDOverlayBX::readNextEvent( int bxNum ){
 
     streamlog_out( DEBUG4 ) << " >>>> readNextEvent( " <<  bxNum << ") called; "
-			    << " lastBXNum  " << lastBXNum  
-			    << " currentRdr  " << currentRdr  
+			    << " lastBXNum  " << _lastBXNum  
+			    << " currentRdr  " << _currentRdr  
 			    << std::endl ;
   
-    if( bxNum != lastBXNum ) {
+    if( bxNum != _lastBXNum ) {
     
       // open a new reader .....
-    
-      int nRdr = _tmpInputFileNames.size(); // not read same file twice or more.
-    
-      if( currentRdr != -1 ) {
-      
-	_lcReaders[currentRdr]->close() ; 
-      
-	streamlog_out( DEBUG4 ) << " >>>> closing reader " << currentRdr 
-				<< " of " << nRdr  << std::endl ;
+      closeCurrentReader() ;
+
+      if( _fileQueue.empty() ) {
+	streamlog_out( WARNING ) << " >>>> no background file left for BX " << bxNum << std::endl ;
+	return 0 ;
       }
 
-      currentRdr = nRdr -1 ; // not read same file twice or more.
-      _lcReaders[currentRdr]->open( _tmpInputFileNames[currentRdr]  ) ; 
-      StringVec::iterator it = _tmpInputFileNames.begin() + currentRdr ;
-      it = _tmpInputFileNames.erase(it); // erase the already read file name.
-      lastEvent = -1 ;
+      _currentRdr = _fileQueue.back() ; // not read same file twice or more.
+      _fileQueue.pop_back() ;
+      _lcReaders[_currentRdr]->open( _inputFileNames[_currentRdr]  ) ; 
 
-      lastBXNum = bxNum ;
+      _lastBXNum = bxNum ;
     }
 
-    LCEvent* evt = _lcReaders[currentRdr]->readNextEvent( LCIO::UPDATE ) ;
+    LCEvent* evt = _lcReaders[_currentRdr]->readNextEvent( LCIO::UPDATE ) ;
 
     if( evt == 0 ) {
-      lastBXNum = -1 ;
-    }else{
-      ++lastEvent ;
+      _lastBXNum = -1 ;
     }
     return evt;
   }
@@ -209,6 +283,10 @@ namespace overlay {
 
   void FPCCDOverlayBX::modifyEvent( LCEvent * evt ) {
 
+    // the frames are written in init(), the events are left as they are
+    if( _frameMode == kGenerateFrames ) 
+      return ;
+
     _colMap.clear();
     _colMap.insert(  std::map<std::string, std::string>::value_type(_vtxPixelHitsCollection, _vtxPixelHitsCollection));
 
@@ -217,9 +295,6 @@ namespace overlay {
   
     //-----------------------------------
     int numBX =  _numBX;
-
-    init_geometry();
-
   
     //-----------------------------------
 
@@ -236,7 +311,6 @@ namespace overlay {
   
     //------------------------------------------------------------
     LCCollection* vxdCol = 0 ; 
-    LCCollection* vxdBGCol = 0 ;
   
     try { 
     
@@ -253,21 +327,172 @@ namespace overlay {
   
     //------------------------------------------------------------
   
-    _tmpInputFileNames = _inputFileNames;
+    int nVXDHits = 0 ;
+    int nElementsDest;
+
+    // the signal pixel hits are summed with the background ones, in the same pixels
+    const bool mergeSignal = ( _removeVTX == false && vxdCol->getNumberOfElements() > 0 ) ;
+
+    if( mergeSignal ) {
+      FPCCDData theSignal(_nLayer,_maxLadder);
+      theSignal.unpackPixelHits( *vxdCol );
+      _pixelAccumulator.add( theSignal , true ) ;
+      theSignal.clear();
+    }
+
+    // the collection is replaced by the packed sum
+    nElementsDest = vxdCol->getNumberOfElements();
+    for(int i=nElementsDest-1 ; i>=0 ; i--){
+      LCObject* object = vxdCol->getElementAt(i);
+      vxdCol->removeElementAt(i);
+      delete object;
+    }
+  
+    if( _frameMode == kConsumeFrames ) {
+      nVXDHits = overlayFrame( vxdCol , mergeSignal ) ;
+    } else {
+      resetFileQueue() ;
+      nVXDHits = accumulateBXs( numBX ) ;
+    }
+
+    if( _frameMode != kConsumeFrames || mergeSignal ) 
+      _pixelAccumulator.pack(*vxdCol);
   
+    streamlog_out( DEBUG3 ) << " total number of VXD bg hits: " << nVXDHits 
+			    << std::endl ;
+  
+    if( streamlog_level(DEBUG3) )
+      LCTOOLS::dumpEvent( evt ) ;
+  
+    _nEvt ++ ;
+  }
+
+
+  //------------------------------------------------------------------------------------------------
+
+  void FPCCDOverlayBX::generateFrames() {
+
+    // each frame from the next NumberOfBunchCrossings files: no file is used twice
+    resetFileQueue() ;
+
+    int nFrames = ( _nFrames >= 0 ? _nFrames : int( _inputFileNames.size() ) / std::max( 1 , _numBX ) ) ;
+
+    std::unique_ptr<LCWriter> writer( LCFactory::getInstance()->createLCWriter() ) ;
+    writer->open( _frameFiles[0] , LCIO::WRITE_NEW ) ;
+
+    for( int iFrame = 0 ; iFrame < nFrames ; iFrame++ ) {
+
+      if( int( _fileQueue.size() ) < _numBX ) {
+	streamlog_out( WARNING ) << " not enough background files left for frame " << iFrame 
+				 << ", " << _nFramesUsed << " frames written" << std::endl ;
+	break ;
+      }
+
+      int nHits = accumulateBXs( _numBX ) ;
+
+      LCEventImpl frame ;
+      frame.setRunNumber( 0 ) ;
+      frame.setEventNumber( iFrame ) ;
+
+      LCCollection* frameCol = new LCCollectionVec( LCIO::LCGENERICOBJECT )  ;
+      _pixelAccumulator.pack( *frameCol ) ;
+      frame.addCollection( frameCol , _vtxPixelHitsCollection ) ;
+
+      writer->writeEvent( &frame ) ;
+      ++_nFramesUsed ;
+
+      streamlog_out( DEBUG4 ) << " wrote frame " << iFrame << " with " << nHits << " pixel hits" << std::endl ;
+    }
+
+    writer->close() ;
+
+    streamlog_out( MESSAGE ) << " wrote " << _nFramesUsed << " readout frames of " << _numBX 
+			     << " BXs to " << _frameFiles[0] << std::endl ;
+  }
+
+
+  //------------------------------------------------------------------------------------------------
+
+  int FPCCDOverlayBX::overlayFrame( LCCollection* vxdCol, bool mergeSignal ) {
+
+    CLHEP::HepRandom::setTheSeed( Global::EVENTSEEDER->getSeed(this) ) ;
+
+    // a random frame of a random file
+    int nFiles = _frameInputs.size() ;
+    int iFile = (int) ( CLHEP::RandFlat::shoot() * nFiles ) ;
+
+    BackgroundFile& file = *_frameInputs[ iFile ] ;
+    int nFrames = file.getNumberOfEvents() ;
+
+    if( nFrames == 0 ) {
+      streamlog_out( WARNING ) << " no readout frame in file " << file.getFileName() << std::endl ;
+      return 0 ;
+    }
+
+    int index = (int) ( CLHEP::RandFlat::shoot() * nFrames ) ;
+
+    StringVec names( 1 , _vtxPixelHitsCollection ) ;
+    LCEvent* frame = file.readEventAt( index , &names ) ;
+
+    if( frame == 0 ) 
+      return 0 ;
+
+    streamlog_out( DEBUG1 ) << " overlay readout frame " << frame->getRunNumber() << "  - "
+			    << frame->getEventNumber() << " from file " << file.getFileName() << std::endl ;
+
+    ++_nFramesUsed ;
+
+    int nElements = 0 ;
+
+    try {
+
+      LCCollection* frameCol = frame->getCollection( _vtxPixelHitsCollection ) ;
+
+      if( mergeSignal ) {
+
+	// summed with the signal pixel hits, packed by the caller
+	FPCCDData theFrame(_nLayer,_maxLadder);
+	theFrame.unpackPixelHits( *frameCol );
+	nElements = _pixelAccumulator.add( theFrame ) ;
+	theFrame.clear();
+
+      } else {
+
+	// already packed: the pixel hit objects are moved as they are
+	nElements = frameCol->getNumberOfElements() ;
+
+	for( int i = 0 ; i < nElements ; i++ ) 
+	  vxdCol->addElement( frameCol->getElementAt(i) ) ;
+
+	for( int i = nElements-1 ; i >= 0 ; i-- ) 
+	  frameCol->removeElementAt(i) ;
+      }
+
+    } catch( DataNotAvailableException& e ) {}
+
+    return nElements ;
+  }
+
+
+  //------------------------------------------------------------------------------------------------
+
+  int FPCCDOverlayBX::accumulateBXs( int numBX ) {
+
+    // the next numBX files of the file queue, summed into the pixel accumulator
     int nVXDHits = 0 ;
-    FPCCDData theSignal(_nLayer,_maxLadder);
     FPCCDData theBkg(_nLayer,_maxLadder);
   
-    // int nSignalhit = theSignal.unpackPixelHits( *vxdCol );
     int nElementsSrc;
-    int nElementsDest;
+    LCCollection* vxdBGCol = 0 ;
+
+    // also called from init(), before _eventsPerBX is set for the events
+    const long eventsPerBX = ( _eventsPerBX >= 0 ? _eventsPerBX : ( 0x1 << 30 ) ) ;
   
     LCEvent* olEvt = 0;
     for(int ii = 0  ; ii < numBX  ; ii++ ) {
     
       // loop over events in one BX ......
-      for(long j=0; j < _eventsPerBX  ; j++ ) {
+      for(long j=0; j < eventsPerBX  ; j++ ) {
       
 	olEvt =  readNextEvent(ii);
 
@@ -283,9 +508,10 @@ namespace overlay {
 
 	  vxdBGCol = olEvt->getCollection( _vtxPixelHitsCollection ) ;
 
-	  // int nBkghit = theBkg.unpackPixelHits(*vxdBGCol);
+	  theBkg.unpackPixelHits(*vxdBGCol);
 
-	  theSignal.Add(theBkg);	
+	  // summed per pixel, packed once after the last BX
+	  nVXDHits += _pixelAccumulator.add(theBkg);
 	
 	  theBkg.clear();
 	
@@ -302,24 +528,11 @@ namespace overlay {
     }
 
     theBkg.clear();
-  
-    nElementsDest = vxdCol->getNumberOfElements();
-    if(_removeVTX == true){
-      for(int i=nElementsDest-1 ; i>=0 ; i--){
-        vxdCol->removeElementAt(i);
-      }
-    }
-  
-    theSignal.packPixelHits(*vxdCol);
-    theSignal.clear();
-  
-    streamlog_out( DEBUG3 ) << " total number of VXD bg hits: " << nVXDHits 
-			    << std::endl ;
-  
-    if( streamlog_level(DEBUG3) )
-      LCTOOLS::dumpEvent( evt ) ;
-  
-    _nEvt ++ ;
+
+    // the last file is not kept open until the next call
+    closeCurrentReader() ;
+
+    return nVXDHits ;
   }
 
 
@@ -333,6 +546,17 @@ namespace overlay {
 
 
   void FPCCDOverlayBX::end(){ 
+
+    closeCurrentReader() ;
+
+    for( auto reader : _lcReaders ) 
+      delete reader ;
+
+    _lcReaders.clear() ;
+    _frameInputs.clear() ;
+
+    if( _frameMode == kConsumeFrames ) 
+      streamlog_out( MESSAGE ) << " overlayed " << _nFramesUsed << " readout frames" << std::endl ;
      
     streamlog_out( MESSAGE ) << " overlayed pair background in VXD detector : " << std::endl ;
   
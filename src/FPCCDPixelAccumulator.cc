@@ -0,0 +1,233 @@
+#include "FPCCDPixelAccumulator.h"
+
+#include "FPCCDData.h"
+
+#include <EVENT/LCCollection.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+
+namespace overlay {
+
+  FPCCDPixelAccumulator::~FPCCDPixelAccumulator() {
+    stopWorkers() ;
+  }
+
+  //===========================================================================================================================
+
+  void FPCCDPixelAccumulator::init( int nLayers, int maxLadder, unsigned int nThreads ) {
+    _nLayers = nLayers ;
+    _maxLadder = maxLadder ;
+    // the ladder hashes keep their buckets from event to event
+    _ladders.resize( std::max( 0, nLayers * maxLadder ) ) ;
+    clear() ;
+
+    nThreads = std::max( 1u, nThreads ) ;
+
+    if( nThreads == _nThreads && _workers.size() + 1 == nThreads ) {
+      return ;
+    }
+
+    // the workers live as long as the accumulator, they sleep between bunch crossings
+    stopWorkers() ;
+    _nThreads = nThreads ;
+    _errors.assign( _nThreads, nullptr ) ;
+
+    // new workers wait for the next bunch crossing, not for the ones added before a restart
+    unsigned long generation = 0 ;
+
+    {
+      std::lock_guard<std::mutex> lock( _poolMutex ) ;
+      generation = _poolGeneration ;
+    }
+
+    for( unsigned int t=1 ; t<_nThreads ; t++ ) {
+      _workers.emplace_back( &FPCCDPixelAccumulator::work, this, t, generation ) ;
+    }
+  }
+
+  //===========================================================================================================================
+
+  unsigned int FPCCDPixelAccumulator::addLadder( FPCCDData& data, unsigned int index ) {
+    const int layer = index / _maxLadder ;
+    const int ladder = index % _maxLadder ;
+    LadderPixels& pixels = _ladders[ index ] ;
+    unsigned int nHits = 0 ;
+
+    for( auto iter = data.itBegin( layer, ladder ) ; iter != data.itEnd( layer, ladder ) ; ++iter ) {
+      const FPCCDPixelHit* hit = iter->second ;
+      const unsigned long long key = ( static_cast<unsigned long long>( hit->getXiID() ) << 32 ) | static_cast<unsigned int>( hit->getZetaID() ) ;
+
+      auto inserted = pixels.emplace( key, PixelSum() ) ;
+      PixelSum& pixel = inserted.first->second ;
+
+      if( inserted.second ) {
+        pixel.edep = hit->getEdep() ;
+        pixel.quality = hit->getQuality() ;
+        pixel.signal = _addingSignal ;
+      }
+      else {
+        pixel.edep += hit->getEdep() ;
+        pixel.quality = pixel.signal ? FPCCDPixelHit::kSignalOverlap : FPCCDPixelHit::kBKGOverlap ;
+      }
+
+      ++nHits ;
+    }
+
+    return nHits ;
+  }
+
+  //===========================================================================================================================
+
+  unsigned int FPCCDPixelAccumulator::add( FPCCDData& data, bool signal ) {
+    // read by the workers after they are woken up
+    _addingSignal = signal ;
+
+    if( _workers.empty() ) {
+      unsigned int nHits = 0 ;
+
+      for( unsigned int i=0 ; i<_ladders.size() ; i++ ) {
+        nHits += addLadder( data, i ) ;
+      }
+
+      return nHits ;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock( _poolMutex ) ;
+      _poolData = &data ;
+      _nextLadder = 0 ;
+      _nAddedHits = 0 ;
+      _nBusyWorkers = _workers.size() ;
+      ++_poolGeneration ;
+    }
+
+    _poolStart.notify_all() ;
+
+    // a ladder is only written by the thread that took it
+    addLadders( data, 0 ) ;
+
+    {
+      std::unique_lock<std::mutex> lock( _poolMutex ) ;
+      _poolDone.wait( lock, [this]() { return 0 == _nBusyWorkers ; } ) ;
+      _poolData = nullptr ;
+    }
+
+    for( auto& error : _errors ) {
+      if( nullptr != error ) {
+        std::exception_ptr thrown = error ;
+        std::fill( _errors.begin(), _errors.end(), nullptr ) ;
+        std::rethrow_exception( thrown ) ;
+      }
+    }
+
+    return _nAddedHits ;
+  }
+
+  //===========================================================================================================================
+
+  void FPCCDPixelAccumulator::addLadders( FPCCDData& data, unsigned int thread ) {
+    try {
+      for ( unsigned int i = _nextLadder++ ; i < _ladders.size() ; i = _nextLadder++ ) {
+        _nAddedHits += addLadder( data, i ) ;
+      }
+    }
+    catch( ... ) {
+      _errors[ thread ] = std::current_exception() ;
+    }
+  }
+
+  //===========================================================================================================================
+
+  void FPCCDPixelAccumulator::work( unsigned int thread, unsigned long generation ) {
+
+    while( true ) {
+      FPCCDData* data = nullptr ;
+
+      {
+        std::unique_lock<std::mutex> lock( _poolMutex ) ;
+        _poolStart.wait( lock, [&]() { return _stopWorkers || _poolGeneration != generation ; } ) ;
+
+        if( _stopWorkers ) {
+          return ;
+        }
+
+        generation = _poolGeneration ;
+        data = _poolData ;
+      }
+
+      addLadders( *data, thread ) ;
+
+      {
+        std::lock_guard<std::mutex> lock( _poolMutex ) ;
+
+        if( 0 == --_nBusyWorkers ) {
+          _poolDone.notify_one() ;
+        }
+      }
+    }
+  }
+
+  //===========================================================================================================================
+
+  void FPCCDPixelAccumulator::stopWorkers() {
+    {
+      std::lock_guard<std::mutex> lock( _poolMutex ) ;
+      _stopWorkers = true ;
+    }
+
+    _poolStart.notify_all() ;
+
+    for ( auto& worker : _workers ) {
+      worker.join() ;
+    }
+
+    _workers.clear() ;
+    _stopWorkers = false ;
+    _nThreads = 1 ;
+  }
+
+  //===========================================================================================================================
+
+  void FPCCDPixelAccumulator::pack( EVENT::LCCollection& collection ) {
+    // FPCCDData owns the packing format: the pixel hits are only created here, once per pixel
+    FPCCDData packed( _nLayers, _maxLadder ) ;
+
+    for( unsigned int i=0 ; i<_ladders.size() ; i++ ) {
+      const int layer = i / _maxLadder ;
+      const int ladder = i % _maxLadder ;
+
+      for( const auto& iter : _ladders[i] ) {
+        FPCCDPixelHit hit( layer, ladder, static_cast<int>( iter.first >> 32 ), static_cast<int>( iter.first & 0xFFFFFFFF ), iter.second.edep, iter.second.quality ) ;
+        packed.addPixelHit( hit, false ) ;
+      }
+    }
+
+    packed.packPixelHits( collection ) ;
+    packed.clear() ;
+    clear() ;
+  }
+
+  //===========================================================================================================================
+
+  void FPCCDPixelAccumulator::clear() {
+    for( auto& pixels : _ladders ) {
+      pixels.clear() ;
+    }
+  }
+
+  //===========================================================================================================================
+
+  unsigned int FPCCDPixelAccumulator::getNPixels() const {
+    unsigned int nPixels = 0 ;
+
+    for( const auto& pixels : _ladders ) {
+      nPixels += pixels.size() ;
+    }
+
+    return nPixels ;
+  }
+
+} // namespace
@@ -0,0 +1,209 @@
+#include "MergeContext.h"
+
+#include <EVENT/LCEvent.h>
+#include <EVENT/LCCollection.h>
+#include "FPCCDData.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <marlin/Global.h>
+#include <gear/GEAR.h>
+#include <gear/VXDParameters.h>
+#include <gear/VXDLayerLayout.h>
+
+#include "streamlog/streamlog.h"
+
+namespace overlay {
+
+  bool setPixelGeometryFromGear( MergeOptions& options ) {
+    if( nullptr == marlin::Global::GEAR ) {
+      return false ;
+    }
+
+    try {
+      const gear::VXDLayerLayout &layerVXD = marlin::Global::GEAR->getVXDParameters().getVXDLayerLayout() ;
+
+      int maxLadder = 0 ;
+      for( int ly=0 ; ly<layerVXD.getNLayers() ; ly++ ) {
+        maxLadder = std::max( maxLadder, layerVXD.getNLadders(ly) ) ;
+      }
+
+      options.pixelLayers = layerVXD.getNLayers() ;
+      options.pixelMaxLadder = maxLadder ;
+    }
+    catch( gear::Exception& ) {
+      return false ;
+    }
+
+    return true ;
+  }
+
+  //===========================================================================================================================
+
+  bool collectionValuesFromStrings( const EVENT::StringVec& pairs, std::map<std::string, float>& values ) {
+    if( pairs.size() % 2 != 0 ) {
+      return false ;
+    }
+
+    for( unsigned int i=0 ; i<pairs.size() ; i+=2 ) {
+      // a typo must not silently become 0 or a truncated value
+      const std::string& token = pairs[i+1] ;
+      char* endPtr = nullptr ;
+      const double value = std::strtod( token.c_str(), &endPtr ) ;
+
+      if( endPtr == token.c_str() || *endPtr != '\0' ) {
+        streamlog_out( ERROR ) << "invalid value '" << token << "' for collection " << pairs[i] << std::endl ;
+        return false ;
+      }
+
+      values[ pairs[i] ] = value ;
+    }
+
+    return true ;
+  }
+
+  //===========================================================================================================================
+  //===========================================================================================================================
+
+  MergeContext::MergeContext() = default ;
+
+  //===========================================================================================================================
+
+  MergeContext::~MergeContext() = default ;
+
+  //===========================================================================================================================
+
+  MergeContext::PixelAccumulator::~PixelAccumulator() = default ;
+
+  //===========================================================================================================================
+
+  void MergeContext::beginEvent( EVENT::LCEvent* evt ) {
+    // the event pointer alone is not enough, the framework may re-use the same address
+    if( evt == _event && evt->getRunNumber() == _runNumber && evt->getEventNumber() == _eventNumber ) {
+      return ;
+    }
+
+    // the collections of the previous event may be gone: too late to pack
+    if( not _pixelAccumulators.empty() || not _compactor.empty() || not _energyFilter.empty() ) {
+      streamlog_out( WARNING ) << "MergeContext::beginEvent: hits merged into the previous event were not flushed and are lost" << std::endl ;
+    }
+
+    clear() ;
+    _event = evt ;
+    _runNumber = evt->getRunNumber() ;
+    _eventNumber = evt->getEventNumber() ;
+  }
+
+  //===========================================================================================================================
+
+  void MergeContext::clear() {
+    _event = nullptr ;
+    _runNumber = -1 ;
+    _eventNumber = -1 ;
+    _cellIndices.clear() ;
+    _gridCellIndices.clear() ;
+    _backgroundCellIndices.clear() ;
+    _pixelAccumulators.clear() ;
+    _collection = nullptr ;
+    _simTrackerHitGrid = -1. ;
+    _compactor.clear() ;
+    _energyFilter.clear() ;
+  }
+
+  //===========================================================================================================================
+
+  void MergeContext::setOptions( const MergeOptions& options ) {
+    _options = options ;
+    _compactor.setMode( options.compaction, options.compactionTimeBin ) ;
+    _energyFilter.setThresholds( options.energyThresholds, options.thresholdMode ) ;
+  }
+
+  //===========================================================================================================================
+
+  void MergeContext::beginCollection( EVENT::LCCollection* dest, const std::string& destName ) {
+    _collection = dest ;
+    _energyFilter.beginCollection( dest, destName ) ;
+
+    auto iter = _options.simTrackerHitCellGrids.find( destName ) ;
+    _simTrackerHitGrid = ( _options.simTrackerHitCellGrids.end() == iter ) ? -1. : std::max( 0.f, iter->second ) ;
+  }
+
+  //===========================================================================================================================
+
+  bool MergeContext::simTrackerHitCellGrid( const EVENT::LCCollection* dest, double& grid ) const {
+    if( dest != _collection || _simTrackerHitGrid < 0. ) {
+      return false ;
+    }
+
+    grid = _simTrackerHitGrid ;
+    return true ;
+  }
+
+  //===========================================================================================================================
+
+  MergeContext::CellIndex& MergeContext::cellIndex( EVENT::LCCollection* dest ) {
+    CellIndex& index = _cellIndices[ dest ] ;
+
+    // elements were removed from the collection since the last merge
+    if( static_cast<unsigned int>( dest->getNumberOfElements() ) < index.nIndexed ) {
+      index.cells.clear() ;
+      index.nIndexed = 0 ;
+    }
+
+    return index ;
+  }
+
+  //===========================================================================================================================
+
+  MergeContext::GridCellIndex& MergeContext::gridCellIndex( EVENT::LCCollection* dest ) {
+    GridCellIndex& index = _gridCellIndices[ dest ] ;
+
+    if( static_cast<unsigned int>( dest->getNumberOfElements() ) < index.nIndexed ) {
+      index.cells.clear() ;
+      index.nIndexed = 0 ;
+    }
+
+    return index ;
+  }
+
+  //===========================================================================================================================
+
+  MergeContext::PixelAccumulator& MergeContext::pixelAccumulator( EVENT::LCCollection* dest ) {
+    PixelAccumulator& accumulator = _pixelAccumulators[ dest ] ;
+
+    if( nullptr == accumulator.hits ) {
+      accumulator.hits.reset( new FPCCDData( _options.pixelLayers, _options.pixelMaxLadder ) ) ;
+      accumulator.buffer.reset( new FPCCDData( _options.pixelLayers, _options.pixelMaxLadder ) ) ;
+
+      // the destination pixel hits are unpacked only once per event, re-packed in flush()
+      accumulator.hits->unpackPixelHits( *dest ) ;
+
+      for( int i=dest->getNumberOfElements()-1 ; i>=0 ; i-- ) {
+        EVENT::LCObject* object = dest->getElementAt(i) ;
+        dest->removeElementAt(i) ;
+        delete object ;
+      }
+    }
+
+    return accumulator ;
+  }
+
+  //===========================================================================================================================
+
+  void MergeContext::flush() {
+    for( auto& iter : _pixelAccumulators ) {
+      iter.second.hits->packPixelHits( *iter.first ) ;
+    }
+
+    _pixelAccumulators.clear() ;
+    _compactor.flush() ;
+    _compactor.clear() ;
+
+    // after the compacted contributions: the cell sums are final. The removed hits may be indexed
+    if( _energyFilter.flush() > 0 ) {
+      _cellIndices.clear() ;
+    }
+  }
+
+} // namespace
@@ -0,0 +1,96 @@
+#include "MergePlan.h"
+
+#include <EVENT/LCEvent.h>
+#include <EVENT/LCCollection.h>
+#include <EVENT/LCIO.h>
+
+#include <unordered_set>
+
+namespace overlay {
+
+  MergeKind mergeKindFromType( const std::string& typeName ) {
+    if( typeName == EVENT::LCIO::MCPARTICLE )        return kMergeMCParticle ;
+    if( typeName == EVENT::LCIO::LCGENERICOBJECT )   return kMergeGenericObject ;
+    if( typeName == EVENT::LCIO::SIMCALORIMETERHIT ) return kMergeSimCalorimeterHit ;
+    if( typeName == EVENT::LCIO::CALORIMETERHIT )    return kMergeCalorimeterHit ;
+    if( typeName == EVENT::LCIO::RAWCALORIMETERHIT ) return kMergeRawCalorimeterHit ;
+    if( typeName == EVENT::LCIO::TRACKERHITPLANE )   return kMergeTrackerHitPlane ;
+    if( typeName == EVENT::LCIO::SIMTRACKERHIT )     return kMergeSimTrackerHit ;
+    return kMergeCopy ;
+  }
+
+  //===========================================================================================================================
+
+  void CollectionIndex::reset( EVENT::LCEvent* evt ) {
+    _event = evt ;
+    _collections.clear() ;
+
+    if( nullptr == evt ) {
+      return ;
+    }
+
+    const EVENT::StringVec* names = evt->getCollectionNames() ;
+    _collections.reserve( names->size() ) ;
+
+    for ( const auto& name : *names ) {
+      _collections[ name ] = evt->getCollection( name ) ;
+    }
+  }
+
+  //===========================================================================================================================
+
+  EVENT::LCCollection* CollectionIndex::find( const std::string& name ) const {
+    auto iter = _collections.find( name ) ;
+    return ( _collections.end() == iter ) ? nullptr : iter->second ;
+  }
+
+  //===========================================================================================================================
+
+  void CollectionIndex::add( const std::string& name, EVENT::LCCollection* col ) {
+    _collections[ name ] = col ;
+  }
+
+  //===========================================================================================================================
+  //===========================================================================================================================
+
+  MergePlan MergePlan::compile( EVENT::LCEvent* srcEvent,
+                                const std::map<std::string, std::string>* mergeMap,
+                                const EVENT::StringVec& excludeCollections,
+                                bool createIfMissing ) {
+    MergePlan plan ;
+
+    const EVENT::StringVec* srcNames = srcEvent->getCollectionNames() ;
+    const std::unordered_set<std::string> srcNameSet( srcNames->begin(), srcNames->end() ) ;
+    const std::unordered_set<std::string> excludeSet( excludeCollections.begin(), excludeCollections.end() ) ;
+
+    // keep the ordering of the (sorted) collection map, as done before plans existed
+    std::map<std::string, std::string> identityMap ;
+
+    if( nullptr == mergeMap ) {
+      for ( const auto& name : *srcNames ) {
+        identityMap[ name ] = name ;
+      }
+      mergeMap = &identityMap ;
+    }
+
+    plan._entries.reserve( mergeMap->size() ) ;
+
+    for ( const auto& pair : *mergeMap ) {
+      // source collection not in this event or excluded: ignore the pair
+      if( srcNameSet.end() == srcNameSet.find( pair.first ) || excludeSet.end() != excludeSet.find( pair.first ) ) {
+        continue ;
+      }
+
+      MergePlanEntry entry ;
+      entry.srcName = pair.first ;
+      entry.destName = pair.second ;
+      entry.typeName = srcEvent->getCollection( pair.first )->getTypeName() ;
+      entry.kind = mergeKindFromType( entry.typeName ) ;
+      entry.createIfMissing = createIfMissing ;
+      plan._entries.push_back( entry ) ;
+    }
+
+    return plan ;
+  }
+
+} // namespace
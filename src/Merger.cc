@@ -6,6 +6,8 @@
 #include "IMPL/LCCollectionVec.h"
 #include "IMPL/SimCalorimeterHitImpl.h"
 #include "IMPL/CalorimeterHitImpl.h"
+#include "IMPL/RawCalorimeterHitImpl.h"
+#include "IMPL/TrackerHitPlaneImpl.h"
 #include "IMPL/MCParticleImpl.h"
 
 
@@ -15,7 +17,7 @@
 
 // #include "IMPL/TrackerHitImpl.h" 
 
-// #include "IMPL/SimTrackerHitImpl.h" 
+#include "IMPL/SimTrackerHitImpl.h"
 #include "FPCCDData.h"
 
 // using namespace EVENT ;
@@ -26,6 +28,8 @@
 
  using namespace std ;
 #include <algorithm>
+#include <cmath>
+#include <unordered_set>
 
 namespace overlay{
   
@@ -85,13 +89,13 @@ namespace overlay{
     const vector<string>* srcColNames = srcEvent->getCollectionNames();
     const vector<string>* destColNames = destEvent->getCollectionNames();
     
-    vector<string>::const_iterator destBeginIt = destColNames->begin();
-    vector<string>::const_iterator destEndIt   = destColNames->end();
-    vector<string>::const_iterator srcEndIt    = srcColNames->end();
-    for (vector<string>::const_iterator it = srcColNames->begin() ; it < srcEndIt ; it++ ) {
-      if (destEndIt != find(destBeginIt, destEndIt, *it)) {
+    // hash the dest names once, then a single pass over the src names
+    const unordered_set<string> destNameSet( destColNames->begin(), destColNames->end() );
+
+    for ( const auto& name : *srcColNames ) {
+      if ( destNameSet.end() != destNameSet.find( name ) ) {
 
-        Merger::merge(srcEvent->getCollection(*it), destEvent->getCollection(*it));
+        Merger::merge(srcEvent->getCollection(name), destEvent->getCollection(name));
         
       }
     }
@@ -99,78 +103,154 @@ namespace overlay{
   }
   
   
-  void Merger::merge(LCEvent* srcEvent, LCEvent* destEvent, map<string, string> *mergeMap) {
-    
-    map<string, string>::iterator it;
-    map<string, string>::iterator endIt = mergeMap->end();
-    for ( it=mergeMap->begin() ; it != endIt ; it++ ) {
-      LCCollection *srcCol, *destCol;
-      
-      try {
-        srcCol = srcEvent->getCollection((*it).first);
-      } catch (DataNotAvailableException& e) {
+  void Merger::merge(LCEvent* srcEvent, LCEvent* destEvent, map<string, string> *mergeMap, MergeContext* context) {
 
+    const MergePlan plan = MergePlan::compile( srcEvent, mergeMap ) ;
 
-	// streamlog_out( DEBUG ) << "The source collection " << (*it).first 
-	//                        << " does not exist." << endl;
+    CollectionIndex destIndex ;
+    destIndex.reset( destEvent ) ;
 
-        continue;
-      }
-      
-      try {
+    Merger::merge( srcEvent, destEvent, plan, destIndex, context ) ;
+    return;
+  }
 
-        destCol = destEvent->getCollection((*it).second);
 
-      } catch (DataNotAvailableException& e) {
+  void Merger::merge(LCEvent* srcEvent, LCEvent* destEvent, const MergePlan& plan, CollectionIndex& destIndex, MergeContext* context) {
+
+    if( nullptr != context ) {
+      context->beginEvent( destEvent ) ;
+    }
+
+    for ( const auto& entry : plan.entries() ) {
+
+      // the plan only contains collections present in the source event
+      LCCollection *srcCol = srcEvent->getCollection( entry.srcName ) ;
+      LCCollection *destCol = destIndex.find( entry.destName ) ;
+
+      if( nullptr == destCol ) {
+
+        if( ! entry.createIfMissing ) {
+          continue;
+        }
+
+        // compacted contributions need new hits, energy thresholds and SimTrackerHit aggregation apply to the background cells one by one
+        const bool perCell = ( nullptr != context &&
+                               ( ( kMergeSimCalorimeterHit == entry.kind && ( context->compactor().enabled() || context->energyFilter().threshold( entry.destName ) > 0. ) ) ||
+                                 ( kMergeSimTrackerHit == entry.kind && context->options().simTrackerHitCellGrids.count( entry.destName ) > 0 ) ) ) ;
+
+        // nothing to merge with: move the whole source collection (with flag and parameters) to the destination event
+        if( not perCell && Merger::adoptCollection( srcEvent, entry.srcName, destEvent, entry.destName ) ) {
+          destIndex.add( entry.destName, srcCol ) ;
+          continue;
+        }
+
+        streamlog_out( DEBUG ) << "destination collection " << entry.destName  << " was created." << endl;
 
-        streamlog_out( DEBUG ) << "destination collection " << (*it).second  << " was created." << endl;
-	
         destCol = new LCCollectionVec( srcCol->getTypeName() ) ;
 
-	// fg: we need to copy all collection parameters from the source collection  
-	
-	//fg: does not work :	destCol->parameters() = srcCol->getParameters() ;
-	// -> do it 'manually':
-
-	StringVec stringKeys ;
-	srcCol->getParameters().getStringKeys( stringKeys ) ;
-	for(unsigned i=0; i< stringKeys.size() ; i++ ){
-	  StringVec vals ;
-	  srcCol->getParameters().getStringVals(  stringKeys[i] , vals ) ;
-	  destCol->parameters().setValues(  stringKeys[i] , vals ) ;   
-	}
-	StringVec intKeys ;
-	srcCol->getParameters().getIntKeys( intKeys ) ;
-	for(unsigned i=0; i< intKeys.size() ; i++ ){
-	  IntVec vals ;
-	  srcCol->getParameters().getIntVals(  intKeys[i] , vals ) ;
-	  destCol->parameters().setValues(  intKeys[i] , vals ) ;   
-	}
-	StringVec floatKeys ;
-	srcCol->getParameters().getFloatKeys( floatKeys ) ;
-	for(unsigned i=0; i< floatKeys.size() ; i++ ){
-	  FloatVec vals ;
-	  srcCol->getParameters().getFloatVals(  floatKeys[i] , vals ) ;
-	  destCol->parameters().setValues(  floatKeys[i] , vals ) ;   
-	}
-	
-	streamlog_out( DEBUG ) <<  " copied collection parameters ... " << std::endl ;
-	streamlog_message( DEBUG , 
-			   LCTOOLS::printParameters( srcCol->getParameters() ) ;
-			   LCTOOLS::printParameters( destCol->getParameters() ) ;
-			   ,"\n" ;  ) ;
-	  
-	destEvent->addCollection( destCol , (*it).second ) ;
+        // fg: we need to copy all collection parameters from the source collection
+        Merger::copyCollectionParameters( srcCol, destCol ) ;
+
+        destEvent->addCollection( destCol , entry.destName ) ;
+        destIndex.add( entry.destName, destCol ) ;
       }
-      
+
+      // a plan is shared by all events with the same collection names: check the types once per collection
+      const string& srcType = srcCol->getTypeName() ;
+
+      if( destCol->getTypeName() != srcType ) {
+        streamlog_out( WARNING ) << "merge not possible, collections of different type" << endl;
+        continue;
+      }
+
       destCol->setFlag( srcCol->getFlag() ) ;
-      
-      Merger::merge(srcCol, destCol);
-      
+
+      if( nullptr != context ) {
+        context->beginCollection( destCol, entry.destName ) ;
+      }
+
+      Merger::merge(srcCol, destCol, ( srcType == entry.typeName ) ? entry.kind : mergeKindFromType( srcType ), context );
+
     }
     return;
   }
 
+
+  bool Merger::adoptCollection(LCEvent* srcEvent, const string& srcName, LCEvent* destEvent, const string& destName) {
+
+    LCCollection *srcCol = srcEvent->getCollection( srcName ) ;
+    const MergeKind kind = mergeKindFromType( srcCol->getTypeName() ) ;
+
+    // pixel hits are re-packed when merged
+    if( kMergeGenericObject == kind ) {
+      return false;
+    }
+
+    if( kMergeMCParticle == kind ) {
+      const int nElements = srcCol->getNumberOfElements() ;
+      for (int i=0; i<nElements; i++) {
+        static_cast<MCParticleImpl*>( srcCol->getElementAt(i) )->setOverlay( true ) ;
+      }
+    }
+
+    const int flag = srcCol->getFlag() ;
+
+    destEvent->addCollection( srcCol, destName ) ;
+
+    // takeCollection() only drops the ownership and marks the collection transient:
+    // make it persistent again, as done in JoinEvents
+    srcEvent->takeCollection( srcName ) ;
+    srcCol->setFlag( flag & ~( 1 << LCCollection::BITTransient ) ) ;
+
+    // the collection is not shared with the source event, which keeps an empty collection instead,
+    // as left by the element-wise merge (the source can be the framework event, e.g. in OverlayEvents)
+    LCCollectionVec* emptyCol = new LCCollectionVec( srcCol->getTypeName() ) ;
+    emptyCol->setFlag( flag ) ;
+    Merger::copyCollectionParameters( srcCol, emptyCol ) ;
+
+    srcEvent->removeCollection( srcName ) ;
+    srcEvent->addCollection( emptyCol, srcName ) ;
+
+    streamlog_out( DEBUG ) << "destination collection " << destName << " was adopted from source collection " << srcName << endl;
+
+    return true;
+  }
+
+
+  void Merger::copyCollectionParameters(LCCollection* srcCol, LCCollection* destCol) {
+
+    //fg: does not work :	destCol->parameters() = srcCol->getParameters() ;
+    // -> do it 'manually':
+
+    StringVec stringKeys ;
+    srcCol->getParameters().getStringKeys( stringKeys ) ;
+    for(unsigned i=0; i< stringKeys.size() ; i++ ){
+      StringVec vals ;
+      srcCol->getParameters().getStringVals(  stringKeys[i] , vals ) ;
+      destCol->parameters().setValues(  stringKeys[i] , vals ) ;
+    }
+    StringVec intKeys ;
+    srcCol->getParameters().getIntKeys( intKeys ) ;
+    for(unsigned i=0; i< intKeys.size() ; i++ ){
+      IntVec vals ;
+      srcCol->getParameters().getIntVals(  intKeys[i] , vals ) ;
+      destCol->parameters().setValues(  intKeys[i] , vals ) ;
+    }
+    StringVec floatKeys ;
+    srcCol->getParameters().getFloatKeys( floatKeys ) ;
+    for(unsigned i=0; i< floatKeys.size() ; i++ ){
+      FloatVec vals ;
+      srcCol->getParameters().getFloatVals(  floatKeys[i] , vals ) ;
+      destCol->parameters().setValues(  floatKeys[i] , vals ) ;
+    }
+
+    streamlog_out( DEBUG ) <<  " copied collection parameters ... " << std::endl ;
+    streamlog_message( DEBUG ,
+                       LCTOOLS::printParameters( srcCol->getParameters() ) ;
+                       LCTOOLS::printParameters( destCol->getParameters() ) ;
+                       ,"\n" ;  ) ;
+  }
+
   
   void Merger::merge(LCEvent* srcEvent, string srcString, LCEvent* destEvent, string destString) {
     try {
@@ -184,7 +264,7 @@ namespace overlay{
   
   
   void Merger::merge(LCCollection* src, LCCollection* dest) {
-    const string destType = dest->getTypeName();
+    const string& destType = dest->getTypeName();
     
     // check if collections have the same type
     if (destType != src->getTypeName()) {
@@ -192,13 +272,18 @@ namespace overlay{
       return;
     }
     
-    streamlog_out( DEBUG4 ) << "merging collection of type: " << destType << " --- \n";
-    
+    Merger::merge( src, dest, mergeKindFromType( destType ) ) ;
+    return;
+  }
+
+
+  namespace {
+
     // JL, May 22 2019: revert logic such that first the special cases are taken care of, 
     // and then everything else is treated like the tracker hits, i.e. a simple copy
     
-    // **MCPARTICLE  **
-    if ( destType == LCIO::MCPARTICLE  )  {
+    // ** MCPARTICLE  **
+    void mergeMCParticles(LCCollection* src, LCCollection* dest, MergeContext*) {
 
       // running trough all the elements in the collection.
       int nElementsSrc = src->getNumberOfElements();
@@ -207,7 +292,7 @@ namespace overlay{
       
       for (int i=nElementsSrc-1; i>=0; i--) {
 	
-	MCParticleImpl* p =  dynamic_cast<MCParticleImpl*>( src->getElementAt(i) ) ;
+	MCParticleImpl* p =  static_cast<MCParticleImpl*>( src->getElementAt(i) ) ;
 	
 	//	p->setSimulatorStatus( set_bit(  p->getSimulatorStatus() ,  BITOverlay  )  ) ;
 	p->setOverlay( true ) ;
@@ -221,12 +306,36 @@ namespace overlay{
     }
     
     // ** LCGENERICOBJECT-VTXPixelHits **
-    else if( destType == LCIO::LCGENERICOBJECT){
+    void mergeGenericObjects(LCCollection* src, LCCollection* dest, MergeContext* context) {
       streamlog_out( DEBUG4 ) << "merging" << endl;
-      int nLayer = 6;
-      int maxLadder = 17;
-      FPCCDData srcData( nLayer, maxLadder);
-      FPCCDData destData( nLayer, maxLadder);
+
+      // with a context: accumulate, the dest collection is packed once in MergeContext::flush()
+      if( nullptr != context ) {
+        MergeContext::PixelAccumulator& accumulator = context->pixelAccumulator( dest );
+
+        int nSrcHits = accumulator.buffer->unpackPixelHits( *src );
+        streamlog_out( DEBUG ) << "number of pixel hits : src-" << nSrcHits << endl;
+
+        accumulator.hits->Add( *accumulator.buffer );
+        accumulator.buffer->clear();
+
+        for(int i=src->getNumberOfElements()-1 ; i>=0 ; i--){
+          LCObject* object = src->getElementAt(i);
+          src->removeElementAt(i);
+          delete object;
+        }
+        return;
+      }
+
+      // the VXD geometry does not change during the job: looked up in GEAR once
+      static const MergeOptions options = []() {
+        MergeOptions gearOptions;
+        setPixelGeometryFromGear( gearOptions );
+        return gearOptions;
+      }();
+
+      FPCCDData srcData( options.pixelLayers, options.pixelMaxLadder );
+      FPCCDData destData( options.pixelLayers, options.pixelMaxLadder );
       
       int nSrcHits = srcData.unpackPixelHits( *src );
       int nDestHits = destData.unpackPixelHits( *dest );
@@ -237,81 +346,262 @@ namespace overlay{
       srcData.clear();
       int nElementsDest = dest->getNumberOfElements();
       for(int i=nElementsDest-1 ; i>=0 ; i--){
+        LCObject* object = dest->getElementAt(i);
 	dest->removeElementAt(i);
+        delete object;
       }
       int nElementsSrc = src->getNumberOfElements();
       for(int i=nElementsSrc-1 ; i>=0 ; i--){
+        LCObject* object = src->getElementAt(i);
 	src->removeElementAt(i);
+        delete object;
       }
       destData.packPixelHits( *dest );
     }
-    
-    // ** SIMCALORIMETERHIT **
-    else if (destType == LCIO::SIMCALORIMETERHIT ) {
-      SimCalorimeterHitImpl *srcHit, *destHit;
+
+    // adds the contributions of srcHit to destHit. With selectedOnly, the ones not selected by 
+    // the last EnergyThresholdFilter::select() of the context are dropped
+    inline void addContributions( SimCalorimeterHitImpl* destHit, SimCalorimeterHitImpl* srcHit, MergeContext* context, bool selectedOnly ) {
+      int numMC = srcHit->getNMCContributions();
+
+      // compacted contributions are written at the end of the event, see MergeContext::flush()
+      const bool compacting = ( nullptr != context && context->compactor().enabled() );
+          
+      for( int j=0 ; j<numMC ; j++){
+        if( selectedOnly && not context->energyFilter().selected(j) ) {
+          context->energyFilter().reject( srcHit->getEnergyCont(j) );
+        } else if( compacting ) {
+          context->compactor().add( destHit, srcHit->getParticleCont(j), srcHit->getEnergyCont(j), srcHit->getTimeCont(j) );
+        } else {
+	  destHit->addMCParticleContribution( srcHit->getParticleCont(j), srcHit->getEnergyCont(j), srcHit->getTimeCont(j), srcHit->getLengthCont(j), srcHit->getPDGCont(j), const_cast<float *>( srcHit->getStepPosition(j)) );
+        }
+      }
+    }
+
+    // per cell merging of a source hit into an existing destination hit.
+    // Returns whether the merged source hit can be deleted right away. Digitised and reconstructed 
+    // hits may be referenced by other objects of the source event: they are left in the source 
+    // collection, which deletes them with the source event.
+    inline bool addToHit( SimCalorimeterHitImpl* destHit, SimCalorimeterHitImpl* srcHit, MergeContext* context ) {
+      const bool filtering = ( nullptr != context && context->energyFilter().filtersContributions() );
+
+      if( filtering ) {
+        context->energyFilter().select( srcHit );
+      }
+
+      addContributions( destHit, srcHit, context, filtering );
+      return true;
+    }
+
+    inline bool addToHit( CalorimeterHitImpl* destHit, CalorimeterHitImpl* srcHit, MergeContext* ) {
+      destHit->setEnergy( destHit->getEnergy() + srcHit->getEnergy() );
+      return false;
+    }
+
+    // digitised hits: sum the ADC counts, keep the earliest time stamp
+    inline bool addToHit( RawCalorimeterHitImpl* destHit, RawCalorimeterHitImpl* srcHit, MergeContext* ) {
+      destHit->setAmplitude( destHit->getAmplitude() + srcHit->getAmplitude() );
+      destHit->setTimeStamp( std::min( destHit->getTimeStamp(), srcHit->getTimeStamp() ) );
+      return false;
+    }
+
+    // the hit to add to the dest collection for a src hit without dest hit in its cell: the src hit itself.
+    // nullptr if nothing is to be added, the src hit is then deleted
+    template <class HitT>
+    inline HitT* moveHit( HitT* srcHit, MergeContext* ) {
+      return srcHit;
+    }
+
+    // with compaction or with contributions below the energy threshold, a new hit receives the 
+    // (compacted) contributions of the src hit, which is deleted
+    template <>
+    inline SimCalorimeterHitImpl* moveHit( SimCalorimeterHitImpl* srcHit, MergeContext* context ) {
+      if( nullptr == context ) {
+        return srcHit;
+      }
+
+      EnergyThresholdFilter& filter = context->energyFilter();
+      const bool compacting = context->compactor().enabled();
+      const bool filtering = filter.filtersContributions();
+
+      if( filtering ) {
+        const int nSelected = filter.select( srcHit );
+
+        if( 0 == nSelected ) {
+          for( int j=0 ; j<srcHit->getNMCContributions() ; j++ ) {
+            filter.reject( srcHit->getEnergyCont(j) );
+          }
+          delete srcHit;
+          return nullptr;
+        }
+
+        if( not compacting && srcHit->getNMCContributions() == nSelected ) {
+          return srcHit;
+        }
+      }
+      else if( not compacting ) {
+        filter.watch( srcHit );
+        return srcHit;
+      }
+
+      SimCalorimeterHitImpl* newHit = new SimCalorimeterHitImpl();
+      newHit->setCellID0( srcHit->getCellID0() );
+      newHit->setCellID1( srcHit->getCellID1() );
+      newHit->setPosition( srcHit->getPosition() );
+
+      addContributions( newHit, srcHit, context, filtering );
+      delete srcHit;
+
+      filter.watch( newHit );
+      return newHit;
+    }
+
+    // ** SIMCALORIMETERHIT, CALORIMETERHIT **
+    template <class HitT>
+    void mergeCellHits(LCCollection* src, LCCollection* dest, MergeContext* context) {
       
       streamlog_out( DEBUG ) << "merging" << endl;
       int nElementsSrc = src->getNumberOfElements();
       int nElementsDest = dest->getNumberOfElements();
       
-      // create a map of dest Collection
-      map<long long, SimCalorimeterHitImpl*> destMap;
-      map<long long, SimCalorimeterHitImpl*>::iterator destMapIt;
-      pair<map<long long, SimCalorimeterHitImpl*>::iterator,bool> res;
-      for (int i=0; i<nElementsDest; i++) {
-        destHit = dynamic_cast<SimCalorimeterHitImpl*> ( dest->getElementAt(i) );
-        res = destMap.insert( pair<long long, SimCalorimeterHitImpl*>(cellID2long(destHit->getCellID0(), destHit->getCellID1()), destHit) );
+      // index of the dest collection: kept in the context for the whole event if any, 
+      // only the hits appended since the last merge need to be indexed
+      MergeContext::CellIndex localIndex;
+      MergeContext::CellIndex& destIndex = ( nullptr != context ) ? context->cellIndex( dest ) : localIndex;
+
+      destIndex.cells.reserve( nElementsDest + nElementsSrc );
+
+      for (int i=destIndex.nIndexed; i<nElementsDest; i++) {
+        HitT* destHit = static_cast<HitT*> ( dest->getElementAt(i) );
+        destIndex.cells.emplace( cellID2long(destHit->getCellID0(), destHit->getCellID1()), destHit );
       }
 
+      // src hits added below are indexed on the next merge: hits of the same src collection are not merged together
+      destIndex.nIndexed = nElementsDest;
+
       // process the src collection and merge with dest
       for (int i=nElementsSrc-1; i>=0 ; i--) {
-        srcHit = dynamic_cast<SimCalorimeterHitImpl*> ( src->getElementAt(i) );
-        if ((destMapIt = destMap.find(cellID2long(srcHit->getCellID0(), srcHit->getCellID1()))) == destMap.end()) {
-          dest->addElement( srcHit );
-        } else {
-          int numMC = srcHit->getNMCContributions();
-          
-          for( int j=0 ; j<numMC ; j++){
-	       destMapIt->second->addMCParticleContribution( srcHit->getParticleCont(j), srcHit->getEnergyCont(j), srcHit->getTimeCont(j), srcHit->getLengthCont(j), srcHit->getPDGCont(j), const_cast<float *>( srcHit->getStepPosition(j)) );
+        HitT* srcHit = static_cast<HitT*> ( src->getElementAt(i) );
+        auto destIt = destIndex.cells.find(cellID2long(srcHit->getCellID0(), srcHit->getCellID1()));
+        if (destIt == destIndex.cells.end()) {
+          HitT* newHit = moveHit( srcHit, context );
+          if( nullptr != newHit ) {
+            dest->addElement( newHit );
           }
-          
+        } else if ( addToHit( static_cast<HitT*>( destIt->second ), srcHit, context ) ) {
           delete srcHit;
+        } else {
+          continue;
         }
         src->removeElementAt(i);
       }
     }
     
-    // ** CALORIMETERHIT **
-    else if (destType == LCIO::CALORIMETERHIT ) {
-      CalorimeterHitImpl *srcHit, *destHit;
-    
+    // charge summing of digitised tracker hits in the same cell
+    inline bool addToHit( TrackerHitPlaneImpl* destHit, TrackerHitPlaneImpl* srcHit, MergeContext* ) {
+      const double destEDep = destHit->getEDep();
+      const double srcEDep = srcHit->getEDep();
+      const double eDep = destEDep + srcEDep;
+
+      // energy weighted position
+      if( eDep > 0. ) {
+        const double* destPos = destHit->getPosition();
+        const double* srcPos = srcHit->getPosition();
+        double pos[3];
+        for( int k=0 ; k<3 ; k++ ) {
+          pos[k] = ( destPos[k] * destEDep + srcPos[k] * srcEDep ) / eDep;
+        }
+        destHit->setPosition( pos );
+      }
+
+      destHit->setEDep( eDep );
+      destHit->setEDepError( std::sqrt( destHit->getEDepError() * destHit->getEDepError() + srcHit->getEDepError() * srcHit->getEDepError() ) );
+      destHit->setTime( std::min( destHit->getTime(), srcHit->getTime() ) );
+
+      const LCObjectVec& srcRawHits = srcHit->getRawHits();
+      destHit->rawHits().insert( destHit->rawHits().end(), srcRawHits.begin(), srcRawHits.end() );
+      return false;
+    }
+
+    void mergeCopy(LCCollection* src, LCCollection* dest, MergeContext* context);
+
+    // ** TRACKERHITPLANE **
+    void mergeTrackerHitPlanes(LCCollection* src, LCCollection* dest, MergeContext* context) {
+
+      const MergeOptions options = ( nullptr != context ) ? context->options() : MergeOptions();
+
+      if( kKeepDuplicates == options.trackerHitPlanePolicy ) {
+        mergeCopy( src, dest, context );
+        return;
+      }
+
       streamlog_out( DEBUG ) << "merging" << endl;
       int nElementsSrc = src->getNumberOfElements();
       int nElementsDest = dest->getNumberOfElements();
-      
-      // create a map of dest Collection
-      map<long long, CalorimeterHitImpl *> destMap;
-      map<long long, CalorimeterHitImpl *>::iterator destMapIt;
-      pair<map<long long, CalorimeterHitImpl *>::iterator,bool> res;
-      for (int i=0; i<nElementsDest; i++) {
-        destHit = dynamic_cast<CalorimeterHitImpl *> ( dest->getElementAt(i) );
-        res = destMap.insert( pair<long long, CalorimeterHitImpl *>(cellID2long(destHit->getCellID0(), destHit->getCellID1()), destHit) );
+
+      MergeContext::GridCellIndex localIndex;
+      MergeContext::GridCellIndex& destIndex = ( nullptr != context ) ? context->gridCellIndex( dest ) : localIndex;
+
+      destIndex.cells.reserve( nElementsDest + nElementsSrc );
+
+      for (int i=destIndex.nIndexed; i<nElementsDest; i++) {
+        TrackerHitPlaneImpl* destHit = static_cast<TrackerHitPlaneImpl*> ( dest->getElementAt(i) );
+        destIndex.cells.emplace( MergeContext::GridCellKey( cellID2long(destHit->getCellID0(), destHit->getCellID1()), gridCell(destHit->getPosition(), options.trackerHitPlaneGrid) ), destHit );
       }
 
-      // process the src collection and merge with dest
+      destIndex.nIndexed = nElementsDest;
+
       for (int i=nElementsSrc-1; i>=0 ; i--) {
-        srcHit = dynamic_cast<CalorimeterHitImpl *> ( src->getElementAt(i) );
-        if ((destMapIt = destMap.find(cellID2long(srcHit->getCellID0(), srcHit->getCellID1()))) == destMap.end()) {
+        TrackerHitPlaneImpl* srcHit = static_cast<TrackerHitPlaneImpl*> ( src->getElementAt(i) );
+        auto destIt = destIndex.cells.find( MergeContext::GridCellKey( cellID2long(srcHit->getCellID0(), srcHit->getCellID1()), gridCell(srcHit->getPosition(), options.trackerHitPlaneGrid) ) );
+        if (destIt == destIndex.cells.end()) {
           dest->addElement( srcHit );
-        } else {
-          destMapIt->second->setEnergy( destMapIt->second->getEnergy() + srcHit->getEnergy() );
+          src->removeElementAt(i);
+        } else if( kSumDuplicates == options.trackerHitPlanePolicy ) {
+          // merged or dropped hits are left in the src collection, see addToHit()
+          addToHit( static_cast<TrackerHitPlaneImpl*>( destIt->second ), srcHit, context );
+        }
+      }
+    }
+    
+    // background hits in the same cell: sum the deposited energy, keep the earliest time.
+    // The other properties (MC particle, position, momentum) are the ones of the first hit
+    inline bool addToHit( SimTrackerHitImpl* destHit, SimTrackerHitImpl* srcHit, MergeContext* ) {
+      destHit->setEDep( destHit->getEDep() + srcHit->getEDep() );
+      destHit->setTime( std::min( destHit->getTime(), srcHit->getTime() ) );
+      return true;
+    }
+
+    // ** SIMTRACKERHIT **
+    void mergeSimTrackerHits(LCCollection* src, LCCollection* dest, MergeContext* context) {
+
+      double grid = 0.;
+
+      if( nullptr == context || not context->simTrackerHitCellGrid( dest, grid ) ) {
+        mergeCopy( src, dest, context );
+        return;
+      }
+
+      streamlog_out( DEBUG ) << "merging" << endl;
+      int nElementsSrc = src->getNumberOfElements();
+
+      // only the background hits merged in this event are indexed: hits of the physics event are kept as they are
+      MergeContext::GridCellIndex& destIndex = context->backgroundCellIndex( dest );
+
+      for (int i=nElementsSrc-1; i>=0 ; i--) {
+        SimTrackerHitImpl* srcHit = static_cast<SimTrackerHitImpl*> ( src->getElementAt(i) );
+        auto inserted = destIndex.cells.emplace( MergeContext::GridCellKey( cellID2long(srcHit->getCellID0(), srcHit->getCellID1()), gridCell(srcHit->getPosition(), grid) ), srcHit );
+        if( inserted.second ) {
+          dest->addElement( srcHit );
+        } else if( addToHit( static_cast<SimTrackerHitImpl*>( inserted.first->second ), srcHit, context ) ) {
+          delete srcHit;
         }
         src->removeElementAt(i);
       }
     }
     
     // ** "TRACKERHITS" **
-    else {
+    void mergeCopy(LCCollection* src, LCCollection* dest, MergeContext*) {
 
       // running trough all the elements in the collection.
       int nElementsSrc = src->getNumberOfElements();
@@ -325,7 +615,56 @@ namespace overlay{
 
       }
     }
-    
+
+    typedef void (*MergeKernel)(LCCollection*, LCCollection*, MergeContext*);
+
+    // indexed by MergeKind
+    const MergeKernel mergeKernels[ kNMergeKinds ] = {
+      &mergeMCParticles,
+      &mergeGenericObjects,
+      &mergeCellHits<SimCalorimeterHitImpl>,
+      &mergeCellHits<CalorimeterHitImpl>,
+      &mergeCellHits<RawCalorimeterHitImpl>,
+      &mergeTrackerHitPlanes,
+      &mergeSimTrackerHits,
+      &mergeCopy
+    };
+
+  } // anonymous namespace
+
+
+  void Merger::merge(LCCollection* src, LCCollection* dest, MergeKind kind, MergeContext* context) {
+
+    streamlog_out( DEBUG4 ) << "merging collection of type: " << dest->getTypeName() << " --- \n";
+
+    // the per collection options are only known for the collection given to MergeContext::beginCollection()
+    if( nullptr != context && dest != context->collection() ) {
+      context->beginCollection( dest, std::string() ) ;
+    }
+
+    // compacted contributions need new hits, energy thresholds and SimTrackerHit aggregation apply to the background cells one by one
+    double grid = 0. ;
+    const bool perCell = ( nullptr != context &&
+                           ( ( kMergeSimCalorimeterHit == kind && ( context->compactor().enabled() || context->energyFilter().active() ) ) ||
+                             ( kMergeSimTrackerHit == kind && context->simTrackerHitCellGrid( dest, grid ) ) ) ) ;
+
+    // empty dest: no per cell merging needed, swap the element vectors instead of moving the elements one by one
+    if( kMergeGenericObject != kind && not perCell && 0 == dest->getNumberOfElements() ) {
+      LCCollectionVec* srcVec = dynamic_cast<LCCollectionVec*>( src ) ;
+      LCCollectionVec* destVec = dynamic_cast<LCCollectionVec*>( dest ) ;
+
+      if( nullptr != srcVec && nullptr != destVec ) {
+        if( kMergeMCParticle == kind ) {
+          for ( auto object : *srcVec ) {
+            static_cast<MCParticleImpl*>( object )->setOverlay( true ) ;
+          }
+        }
+        destVec->swap( *srcVec ) ;
+        return;
+      }
+    }
+
+    mergeKernels[ kind ]( src, dest, context ) ;
     return;
   }
 
@@ -0,0 +1,104 @@
+#include "OccupancyMonitor.h"
+
+#include <EVENT/LCEvent.h>
+
+#include "streamlog/streamlog.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace overlay {
+
+  void OccupancyMonitor::setCollections( const EVENT::StringVec& collectionNames ) {
+    _collections.clear() ;
+    _nEvents = 0 ;
+
+    for( const auto& name : collectionNames ) {
+      if( index( name ) < 0 ) {
+        CollectionCounts counts ;
+        counts.name = name ;
+        _collections.push_back( counts ) ;
+      }
+    }
+  }
+
+  //===========================================================================================================================
+
+  int OccupancyMonitor::index( const std::string& collectionName ) const {
+    for( unsigned int i=0 ; i<_collections.size() ; i++ ) {
+      if( _collections[i].name == collectionName ) {
+        return i ;
+      }
+    }
+    return -1 ;
+  }
+
+  //===========================================================================================================================
+
+  void OccupancyMonitor::endEvent( EVENT::LCEvent* event, const std::string& prefix ) {
+    if( not enabled() ) {
+      return ;
+    }
+
+    ++_nEvents ;
+
+    for( auto& collection : _collections ) {
+      const unsigned int nLayers = std::max( collection.counts.size(), collection.sum.size() ) ;
+
+      collection.counts.resize( nLayers, 0 ) ;
+      collection.sum.resize( nLayers, 0. ) ;
+      collection.sum2.resize( nLayers, 0. ) ;
+
+      EVENT::IntVec values( nLayers ) ;
+
+      for( unsigned int l=0 ; l<nLayers ; l++ ) {
+        const double count = collection.counts[l] ;
+        values[l] = collection.counts[l] ;
+        collection.sum[l] += count ;
+        collection.sum2[l] += count * count ;
+      }
+
+      event->parameters().setValues( prefix + collection.name, values ) ;
+      std::fill( collection.counts.begin(), collection.counts.end(), 0 ) ;
+    }
+  }
+
+  //===========================================================================================================================
+
+  double OccupancyMonitor::getMean( int collection, unsigned int layer ) const {
+    const CollectionCounts& counts = _collections[ collection ] ;
+
+    if( 0 == _nEvents || layer >= counts.sum.size() ) {
+      return 0. ;
+    }
+
+    return counts.sum[ layer ] / _nEvents ;
+  }
+
+  //===========================================================================================================================
+
+  double OccupancyMonitor::getRMS( int collection, unsigned int layer ) const {
+    const CollectionCounts& counts = _collections[ collection ] ;
+
+    if( 0 == _nEvents || layer >= counts.sum2.size() ) {
+      return 0. ;
+    }
+
+    const double mean = getMean( collection, layer ) ;
+    return std::sqrt( std::max( 0., counts.sum2[ layer ] / _nEvents - mean * mean ) ) ;
+  }
+
+  //===========================================================================================================================
+
+  void OccupancyMonitor::print() const {
+    for( unsigned int i=0 ; i<_collections.size() ; i++ ) {
+      streamlog_out( MESSAGE ) << " overlaid background hits per event in " << _collections[i].name
+                               << " (" << _nEvents << " events) : " << std::endl ;
+
+      for( unsigned int l=0 ; l<getNLayers(i) ; l++ ) {
+        streamlog_out( MESSAGE ) << "   layer " << l << " : mean " << getMean( i, l ) << " , rms " << getRMS( i, l ) << std::endl ;
+      }
+    }
+  }
+
+} // namespace
@@ -26,6 +26,12 @@
 #include "CLHEP/Random/RandFlat.h"
 // #include <time.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <exception>
+#include <thread>
+
 using namespace lcio ;
 using namespace marlin ;
 
@@ -35,57 +41,49 @@ namespace overlay {
   
   /// Set the lcio file name
   void LCFileHandler::setFileName(const std::string& fname) {
-    _fileName = fname ;
+    _file = BackgroundFileRegistry::instance().acquire( fname ) ;
   }
   
   //===========================================================================================================================
   
   /// Get the number of events available in the file
   unsigned int LCFileHandler::getNumberOfEvents() const {
-    openFile() ;
-    return _lcReader->getNumberOfEvents() ;
+    return _file->getNumberOfEvents() ;
   }
   
   //===========================================================================================================================
   
   /// Get the event number at the specified index (look in the event map)
   unsigned int LCFileHandler::getEventNumber(unsigned int index) const {
-    openFile() ;
-    return _eventMap.at( index * 2 + 1 ) ;
+    return _file->getEventNumber( index ) ;
   }
   
   //===========================================================================================================================
   
   /// Get the run number at the specified index (look in the event map)
   unsigned int LCFileHandler::getRunNumber(unsigned int index) const {
-    openFile() ;
-    return _eventMap.at( index * 2 ) ;
+    return _file->getRunNumber( index ) ;
   }
   
   //===========================================================================================================================
   
   /// Read the specified event, by run and event number
   EVENT::LCEvent* LCFileHandler::readEvent(int runNumber, int eventNumber) {
-    openFile();
-    streamlog_out( DEBUG6 ) << "*** Reading event from file : '" << _fileName 
-          << "',  event number " << eventNumber << " of run " << runNumber << "." << std::endl ;
-    return _lcReader->readEvent( runNumber, eventNumber, LCIO::UPDATE );
+    return _file->readEvent( runNumber, eventNumber ) ;
   }
-  
+
   //===========================================================================================================================
   
-  /// Proxy method to open the LCIO file
-  void LCFileHandler::openFile() const {
-    if(nullptr == _lcReader) {
-      _lcReader = std::shared_ptr<IO::LCReader>( LCFactory::getInstance()->createLCReader( LCReader::directAccess ) ) ;
-      
-      streamlog_out( MESSAGE ) << "*** Opening file for overlay, file name:" << _fileName << std::endl ;
-            
-      _lcReader->open( _fileName ) ;
-      _lcReader->getEvents( _eventMap ) ;
-      
-      streamlog_out( MESSAGE ) << "*** Opening file for overlay : number of available events: " << _lcReader->getNumberOfEvents() << std::endl ;
-    }
+  /// Read the event at the specified index, streamed if it follows the previous one
+  EVENT::LCEvent* LCFileHandler::readEventAt(unsigned int index) {
+    return _file->readEventAt( index ) ;
+  }
+
+  //===========================================================================================================================
+
+  /// Open the LCIO file and build the event map
+  void LCFileHandler::index() const {
+    _file->index() ;
   }
 
   //===========================================================================================================================
@@ -121,6 +119,56 @@ namespace overlay {
         "List of collections to exclude for merging"  ,
         _excludeCollections ,
         StringVec() ) ;
+
+    registerOptionalParameter( "BackgroundSources" ,
+        "Named background sources, each given as 'name expBG file1 file2[:weight] ... ;'"  ,
+        _backgroundSources ,
+        StringVec() ) ;
+
+    registerProcessorParameter( "BlockSize" ,
+        "Number of consecutive events of a file sampled at once, read sequentially (default 1, i.e. independent sampling)"  ,
+        _blockSize ,
+        static_cast<int>(1) ) ;
+
+    registerProcessorParameter( "IndexingThreads" ,
+        "Number of threads used to open and index the input files at the first event (default 1)"  ,
+        _nIndexingThreads ,
+        static_cast<int>(1) ) ;
+
+    registerProcessorParameter( "TrackerHitPlaneMergePolicy" ,
+        "Policy for digitised TrackerHitPlane hits in the same cell : Keep (both hits), KeepFirst or Sum (default Keep)"  ,
+        _trackerHitPlanePolicy ,
+        std::string("Keep") ) ;
+
+    registerProcessorParameter( "TrackerHitPlaneMergeGrid" ,
+        "Position grid (mm) defining a cell within a TrackerHitPlane cellID for the merge policy. 0: cellID only (default 0)"  ,
+        _trackerHitPlaneGrid ,
+        static_cast<float>(0.) ) ;
+
+    registerProcessorParameter( "ContributionCompaction" ,
+        "Compaction of the background MC contributions of SimCalorimeterHits : None, TimeBinned (per cell and time bin) or EnergyOnly (per cell) (default None)"  ,
+        _compaction ,
+        std::string("None") ) ;
+
+    registerProcessorParameter( "CompactionTimeBin" ,
+        "Time bin width (ns) for the TimeBinned contribution compaction (default 1)"  ,
+        _compactionTimeBin ,
+        static_cast<float>(1.) ) ;
+
+    registerProcessorParameter( "BackgroundEnergyThresholds" ,
+        "Pairs of destination SimCalorimeterHit collection name and energy threshold (GeV) below which background energy is dropped"  ,
+        _energyThresholds ,
+        EVENT::StringVec() ) ;
+
+    registerProcessorParameter( "EnergyThresholdMode" ,
+        "What the BackgroundEnergyThresholds are applied to : Contribution (each background MC contribution) or CellSum (the cells created by the background) (default Contribution)"  ,
+        _thresholdMode ,
+        std::string("Contribution") ) ;
+
+    registerProcessorParameter( "SimTrackerHitCellMerging" ,
+        "Pairs of destination SimTrackerHit collection name and position grid (mm, 0: cellID only) whose background hits are aggregated per cell"  ,
+        _simTrackerHitCells ,
+        EVENT::StringVec() ) ;
   }
   
   //===========================================================================================================================
@@ -141,11 +189,81 @@ namespace overlay {
     // usually a good idea to
     printParameters() ;
     
+    // the default (unnamed) source from InputFileNames, NumberOverlayEvents and expBG
+    if( ! parameterSet("BackgroundSources") || parameterSet("InputFileNames") ) {
+      BackgroundSource source ;
+      source.numOverlay = _numOverlay ;
+      source.poisson = parameterSet("expBG") ;
+      source.expBG = _expBG ;
+      source.fileNames = _fileNames ;
+      source.fileWeights.assign( _fileNames.size(), -1. ) ;
+      _sources.push_back( source ) ;
+    }
+
+    parseBackgroundSources() ;
+
     // prepare the lcio file handlers
-    _lcFileHandlerList.resize( _fileNames.size() ) ;
-    
-    for ( unsigned int i=0 ; i<_fileNames.size() ; i++ )
-      _lcFileHandlerList.at( i ).setFileName( _fileNames.at( i ) ) ;
+    for ( auto& source : _sources ) {
+      source.fileHandlers.resize( source.fileNames.size() ) ;
+
+      for ( unsigned int i=0 ; i<source.fileNames.size() ; i++ )
+        source.fileHandlers.at( i ).setFileName( source.fileNames.at( i ) ) ;
+    }
+  
+    // merge kernel options
+    MergeOptions mergeOptions ;
+    mergeOptions.trackerHitPlaneGrid = _trackerHitPlaneGrid ;
+
+    if( "Keep" == _trackerHitPlanePolicy ) {
+      mergeOptions.trackerHitPlanePolicy = kKeepDuplicates ;
+    }
+    else if( "KeepFirst" == _trackerHitPlanePolicy ) {
+      mergeOptions.trackerHitPlanePolicy = kKeepFirst ;
+    }
+    else if( "Sum" == _trackerHitPlanePolicy ) {
+      mergeOptions.trackerHitPlanePolicy = kSumDuplicates ;
+    }
+    else {
+      throw Exception( "Overlay::init: invalid TrackerHitPlaneMergePolicy '" + _trackerHitPlanePolicy + "', expected Keep, KeepFirst or Sum" ) ;
+    }
+
+    if( not compactionModeFromString( _compaction, mergeOptions.compaction ) ) {
+      throw Exception( "Overlay::init: invalid ContributionCompaction '" + _compaction + "', expected None, TimeBinned or EnergyOnly" ) ;
+    }
+
+    mergeOptions.compactionTimeBin = _compactionTimeBin ;
+
+    if( not collectionValuesFromStrings( _energyThresholds, mergeOptions.energyThresholds ) ) {
+      throw Exception( "Overlay::init: BackgroundEnergyThresholds needs pairs of collection name and threshold (GeV)" ) ;
+    }
+
+    for( const auto& threshold : mergeOptions.energyThresholds ) {
+      if( threshold.second < 0. ) {
+        throw Exception( "Overlay::init: negative BackgroundEnergyThresholds value for collection " + threshold.first ) ;
+      }
+    }
+
+    if( not thresholdModeFromString( _thresholdMode, mergeOptions.thresholdMode ) ) {
+      throw Exception( "Overlay::init: invalid EnergyThresholdMode '" + _thresholdMode + "', expected Contribution or CellSum" ) ;
+    }
+
+    if( not collectionValuesFromStrings( _simTrackerHitCells, mergeOptions.simTrackerHitCellGrids ) ) {
+      throw Exception( "Overlay::init: SimTrackerHitCellMerging needs pairs of collection name and grid (mm)" ) ;
+    }
+
+    // 0 is a valid grid (cellID only), a negative one is a typo
+    for( const auto& grid : mergeOptions.simTrackerHitCellGrids ) {
+      if( grid.second < 0. ) {
+        throw Exception( "Overlay::init: negative SimTrackerHitCellMerging grid for collection " + grid.first ) ;
+      }
+    }
+
+    // FPCCD pixel geometry, default 6 layers with at most 17 ladders
+    if( not setPixelGeometryFromGear( mergeOptions ) ) {
+      streamlog_out( DEBUG5 ) << "No VXD geometry in GEAR, using the default FPCCD pixel geometry for LCGenericObject merges" << std::endl ;
+    }
+
+    _mergeContext.setOptions( mergeOptions ) ;
   
     // initalisation of random number generator
     Global::EVENTSEEDER->registerProcessor(this) ;
@@ -182,6 +300,11 @@ namespace overlay {
 
     if( isFirstEvent() ) {
       // get it here and not in init as files are opened on function call
+      indexInputFiles() ;
+
+      for ( auto& source : _sources ) {
+        prepareSource( source ) ;
+      }
       _nAvailableEvents = getNAvailableEvents() ;
       
       streamlog_out( MESSAGE ) << "Overlay::modifyEvent: total number of available events to overlay: " << _nAvailableEvents << std::endl ;
@@ -191,63 +314,63 @@ namespace overlay {
     int eventSeed = Global::EVENTSEEDER->getSeed(this);
     CLHEP::HepRandom::setTheSeed( eventSeed );
 
+    int nOverlaidEvents(0);
+    EVENT::FloatVec overlaidEventIDs, overlaidRunIDs;
 
-    unsigned int nEventsToOverlay = _numOverlay ;
-  
-    if ( parameterSet("expBG") ) {
-      nEventsToOverlay += CLHEP::RandPoisson::shoot( _expBG ) ;
+    // blocks do not continue across physics events: the overlay only depends on the event seed
+    for ( auto& source : _sources ) {
+      source.blockRemaining = 0 ;
     }
 
-    streamlog_out( DEBUG6 ) << "** Processing event nr " << evt->getEventNumber() << " run " <<  evt->getRunNumber() 
-     			    << "\n**  overlaying " << nEventsToOverlay << " background events. \n " 
-			    << " ( seeded CLHEP::HepRandom with seed = " << eventSeed  << ") " 
-			    << std::endl;
+    // index the physics event collections once, created collections are added on the fly
+    _destIndex.reset( evt ) ;
+
+    for ( auto& source : _sources ) {
+
+      unsigned int nEventsToOverlay = source.numOverlay ;
   
-    int nOverlaidEvents(0);
-    EVENT::FloatVec overlaidEventIDs, overlaidRunIDs;
-    
-    for(unsigned int i=0 ; i < nEventsToOverlay ; i++ ) {
+      if ( source.poisson ) {
+        nEventsToOverlay += CLHEP::RandPoisson::shoot( source.expBG ) ;
+      }
+
+      streamlog_out( DEBUG6 ) << "** Processing event nr " << evt->getEventNumber() << " run " <<  evt->getRunNumber() 
+                              << "\n**  overlaying " << nEventsToOverlay << " background events " 
+                              << ( source.name.empty() ? "" : "from source " + source.name ) << ". \n " 
+                              << " ( seeded CLHEP::HepRandom with seed = " << eventSeed  << ") " 
+                              << std::endl;
+
+      int nSourceOverlaidEvents(0);
 
-      EVENT::LCEvent *overlayEvent = readNextEvent() ;
+      for(unsigned int i=0 ; i < nEventsToOverlay ; i++ ) {
 
-      if( nullptr == overlayEvent ) {
-	       streamlog_out( ERROR ) << "loop: " << i << " ++++++++++ Nothing to overlay +++++++++++ \n " ;
-	       continue ;
-      } 
+        EVENT::LCEvent *overlayEvent = readNextEvent( source ) ;
+
+        if( nullptr == overlayEvent ) {
+          streamlog_out( ERROR ) << "loop: " << i << " ++++++++++ Nothing to overlay +++++++++++ \n " ;
+          continue ;
+        } 
       
-      overlaidEventIDs.push_back( overlayEvent->getEventNumber() );
-      overlaidRunIDs.push_back( overlayEvent->getRunNumber() );
+        overlaidEventIDs.push_back( overlayEvent->getEventNumber() );
+        overlaidRunIDs.push_back( overlayEvent->getRunNumber() );
       
-      ++nOverlaidEvents ;
+        ++nSourceOverlaidEvents ;
 
-      streamlog_out( DEBUG6 ) << "loop: " << i << " will overlay event " << overlayEvent->getEventNumber() << " - run " << overlayEvent->getRunNumber() << std::endl ;
+        streamlog_out( DEBUG6 ) << "loop: " << i << " will overlay event " << overlayEvent->getEventNumber() << " - run " << overlayEvent->getRunNumber() << std::endl ;
 
-      std::map<std::string, std::string> collectionMap;
-      
-      if ( ( _overlayCollectionMap.empty() || ! parameterSet("CollectionMap") ) ) {
-        auto collectionNames = overlayEvent->getCollectionNames();
-        for ( auto collection : *collectionNames ) {
-          collectionMap[collection] = collection;
-          streamlog_out( DEBUG6 ) << "Collection map -> " << collection << std::endl;
-        }
-      }
-      else {
-        collectionMap = _overlayCollectionMap;
+        Merger::merge( overlayEvent, evt, getMergePlan( overlayEvent ), _destIndex, &_mergeContext );
       }
-      
-      // Remove collections to exclude from the collection map
-      if(not _excludeCollections.empty()) {
-        for ( auto excludeCol : _excludeCollections ) {
-          auto findIter = collectionMap.find( excludeCol );
-          if( collectionMap.end() != findIter ) {
-            collectionMap.erase( findIter );
-          }
-        }
+
+      if( not source.name.empty() ) {
+        evt->parameters().setValue( "Overlay." + this->name() + "." + source.name + ".nEvents", nSourceOverlaidEvents );
       }
 
-	     Merger::merge( overlayEvent, evt, &collectionMap );
+      source.nTotalOverlayEvents += nSourceOverlaidEvents ;
+      nOverlaidEvents += nSourceOverlaidEvents ;
     }
     
+    // pack the accumulated pixel hits, once per event
+    _mergeContext.flush() ;
+
     _nTotalOverlayEvents += nOverlaidEvents;
     
     // Write info to event parameters
@@ -274,50 +397,260 @@ namespace overlay {
 			     << "      -> mean = " << double(_nTotalOverlayEvents ) / double( _nEvt ) 
 			     << "  ±  " <<   double(_nTotalOverlayEvents ) / double( _nEvt ) / sqrt( _nEvt ) << "\n"
 			     << std::endl ;
+
+    for ( const auto& source : _sources ) {
+      if( source.name.empty() ) {
+        continue ;
+      }
+      streamlog_out( MESSAGE ) << "      source " << source.name << " : " << source.nTotalOverlayEvents << " background events"
+                               << " -> mean = " << double( source.nTotalOverlayEvents ) / double( _nEvt ) << std::endl ;
+    }
+
+    const EnergyThresholdFilter& filter = _mergeContext.energyFilter() ;
+
+    if( filter.enabled() ) {
+      streamlog_out( MESSAGE ) << "      background energy below threshold : " << filter.getNRejectedContributions() << " contributions ("
+                               << filter.getRejectedContributionEnergy() << " GeV), " << filter.getNRejectedCells() << " cells ("
+                               << filter.getRejectedCellEnergy() << " GeV)" << std::endl ;
+    }
   }
 
 
   //===========================================================================================================================
 
-  EVENT::LCEvent* Overlay::readNextEvent() {
-    
-    EVENT::LCEvent* overlayEvent = nullptr ;
-    
-    // get the event index to random pick an event among the possible files
-    const unsigned int eventIndex = CLHEP::RandFlat::shoot( static_cast<double>( _nAvailableEvents ) ) ;
-    unsigned int currentEventIndex(0);
+  EVENT::LCEvent* Overlay::readNextEvent( BackgroundSource& source ) {
     
-    streamlog_out( DEBUG ) << "Overlay::readNextEvent: index = " << eventIndex  << " over " << _nAvailableEvents << std::endl ;
+    if( source.fileTable.empty() ) {
+      return nullptr ;
+    }
+
+    // continue the current sampling block if any
+    if( source.blockRemaining > 0 && source.blockNextIndex < source.fileHandlers.at( source.blockFile ).getNumberOfEvents() ) {
+
+      LCFileHandler& handler = source.fileHandlers.at( source.blockFile ) ;
+      const unsigned int eventIndex = source.blockNextIndex ;
+
+      streamlog_out( DEBUG ) << "Overlay::readNextEvent: file = " << source.blockFile << ", index = " << eventIndex  << " (block)" << std::endl ;
+
+      ++source.blockNextIndex ;
+      --source.blockRemaining ;
+
+      return handler.readEventAt( eventIndex ) ;
+    }
+
+    // pick a file according to its weight, then an event uniformly in the file
+    const unsigned int fileIndex = source.fileTable.sample( CLHEP::RandFlat::shoot() ) ;
+    LCFileHandler& handler = source.fileHandlers.at( fileIndex ) ;
+    const unsigned int nFileEvents = handler.getNumberOfEvents() ;
+
+    if( 0 == nFileEvents ) {
+      return nullptr ;
+    }
+
+    unsigned int eventIndex = CLHEP::RandFlat::shoot( static_cast<double>( nFileEvents ) ) ;
+    eventIndex = std::min( eventIndex, nFileEvents - 1 ) ;
+
+    streamlog_out( DEBUG ) << "Overlay::readNextEvent: file = " << fileIndex << ", index = " << eventIndex  << " over " << nFileEvents << std::endl ;
+
+    if( _blockSize > 1 ) {
+      source.blockFile = fileIndex ;
+      source.blockNextIndex = eventIndex + 1 ;
+      source.blockRemaining = _blockSize - 1 ;
+
+      return handler.readEventAt( eventIndex ) ;
+    }
     
-    for ( auto &handler : _lcFileHandlerList ) {
-      
-      if ( currentEventIndex <= eventIndex && eventIndex < currentEventIndex + handler.getNumberOfEvents() ) {
+    const int eventNumber = handler.getEventNumber( eventIndex ) ;
+    const int runNumber = handler.getRunNumber( eventIndex ) ;
         
-        const int eventNumber = handler.getEventNumber( eventIndex-currentEventIndex ) ;
-        const int runNumber = handler.getRunNumber( eventIndex-currentEventIndex ) ;
+    EVENT::LCEvent* overlayEvent = handler.readEvent( runNumber, eventNumber ) ;
         
-        overlayEvent = handler.readEvent( runNumber, eventNumber ) ;
-        
-        if( nullptr == overlayEvent ) {
-          streamlog_out( ERROR ) << "Overlay::readNextEvent: Could not read event " << eventNumber << "  from  run " <<  runNumber << std::endl ;
-        }
-        
-        break;
-      }
-      currentEventIndex += handler.getNumberOfEvents() ;
+    if( nullptr == overlayEvent ) {
+      streamlog_out( ERROR ) << "Overlay::readNextEvent: Could not read event " << eventNumber << "  from  run " <<  runNumber << std::endl ;
     }
     
     return overlayEvent ;
   }
   
+  //===========================================================================================================================
+
+  void Overlay::parseBackgroundSources() {
+
+    BackgroundSource* current = nullptr ;
+    unsigned int nHeaderTokens(0) ;
+
+    for ( auto token : _backgroundSources ) {
+
+      // a trailing ';' closes the current source
+      bool closeSource = false ;
+      if( not token.empty() && ';' == token.back() ) {
+        token.pop_back() ;
+        closeSource = true ;
+      }
+
+      if( not token.empty() ) {
+
+        if( nullptr == current ) {
+          _sources.push_back( BackgroundSource() ) ;
+          current = &_sources.back() ;
+          current->name = token ;
+          current->poisson = true ;
+          nHeaderTokens = 1 ;
+        }
+        else if( 1 == nHeaderTokens ) {
+          char* endPtr = nullptr ;
+          current->expBG = std::strtod( token.c_str(), &endPtr ) ;
+          if( endPtr == token.c_str() || *endPtr != '\0' ) {
+            throw Exception( "Overlay: invalid expBG '" + token + "' for background source " + current->name ) ;
+          }
+          nHeaderTokens = 2 ;
+        }
+        else {
+          // optional ':weight' suffix
+          double weight = -1. ;
+          const auto colonPos = token.rfind( ':' ) ;
+          if( std::string::npos != colonPos ) {
+            const std::string weightStr = token.substr( colonPos + 1 ) ;
+            char* endPtr = nullptr ;
+            const double value = std::strtod( weightStr.c_str(), &endPtr ) ;
+            if( not weightStr.empty() && *endPtr == '\0' ) {
+              weight = value ;
+              token = token.substr( 0, colonPos ) ;
+            }
+          }
+          current->fileNames.push_back( token ) ;
+          current->fileWeights.push_back( weight ) ;
+        }
+      }
+
+      if( closeSource ) {
+        current = nullptr ;
+      }
+    }
+
+    for ( const auto& source : _sources ) {
+      if( source.fileNames.empty() ) {
+        throw Exception( "Overlay: background source '" + source.name + "' has no input file" ) ;
+      }
+      streamlog_out( MESSAGE ) << "Overlay: background source '" << source.name << "' : expBG = " << source.expBG 
+                               << ", " << source.fileNames.size() << " file(s)" << std::endl ;
+    }
+  }
+
+  //===========================================================================================================================
+
+  void Overlay::prepareSource( BackgroundSource& source ) const {
+
+    std::vector<double> weights( source.fileHandlers.size(), 0. ) ;
+    source.nAvailableEvents = 0 ;
+
+    for ( unsigned int i=0 ; i<source.fileHandlers.size() ; i++ ) {
+      const unsigned int nFileEvents = source.fileHandlers.at( i ).getNumberOfEvents() ;
+      source.nAvailableEvents += nFileEvents ;
+
+      // files without events are never sampled
+      if( nFileEvents > 0 ) {
+        weights[i] = ( source.fileWeights.at( i ) < 0. ) ? nFileEvents : source.fileWeights.at( i ) ;
+      }
+    }
+
+    source.fileTable.build( weights ) ;
+  }
+
+  //===========================================================================================================================
+
+  const MergePlan& Overlay::getMergePlan( EVENT::LCEvent* overlayEvent ) {
+
+    const EVENT::StringVec* collectionNames = overlayEvent->getCollectionNames() ;
+    auto findIter = _mergePlans.find( *collectionNames ) ;
+
+    if( _mergePlans.end() != findIter ) {
+      return findIter->second ;
+    }
+
+    // no collection map given: merge all collections with the same name
+    const bool mergeAll = ( _overlayCollectionMap.empty() || ! parameterSet("CollectionMap") ) ;
+    const MergePlan plan = MergePlan::compile( overlayEvent, mergeAll ? nullptr : &_overlayCollectionMap, _excludeCollections ) ;
+
+    streamlog_out( DEBUG6 ) << "Overlay::getMergePlan: compiled merge plan for " << collectionNames->size() << " collections :" << std::endl ;
+
+    for ( const auto& entry : plan.entries() ) {
+      streamlog_out( DEBUG6 ) << "Collection map -> " << entry.srcName << " -> " << entry.destName << std::endl ;
+    }
+
+    return _mergePlans.insert( std::make_pair( *collectionNames, plan ) ).first->second ;
+  }
+  
+  //===========================================================================================================================
+
+  void Overlay::indexInputFiles() {
+
+    std::vector<const LCFileHandler*> handlers ;
+
+    for ( const auto& source : _sources ) {
+      for ( const auto& handler : source.fileHandlers ) {
+        handlers.push_back( &handler ) ;
+      }
+    }
+
+    unsigned int nThreads = std::max( 1, _nIndexingThreads ) ;
+
+    if( nThreads > 1 && ! LCIO_VERSION_GE( 2 , 13 ) ) {
+      streamlog_out( WARNING ) << "Overlay::indexInputFiles: parallel file indexing requires LCIO v2.13 or higher, using 1 thread" << std::endl ;
+      nThreads = 1 ;
+    }
+
+    nThreads = std::min( nThreads, static_cast<unsigned int>( handlers.size() ) ) ;
+
+    streamlog_out( MESSAGE ) << "Overlay::indexInputFiles: indexing " << handlers.size() << " file(s) with " << nThreads << " thread(s)" << std::endl ;
+
+    // make sure the factory singleton exists before the workers use it
+    LCFactory::getInstance() ;
+
+    std::atomic<unsigned int> nextHandler(0) ;
+    std::vector<std::exception_ptr> errors( handlers.size() ) ;
+
+    auto worker = [&]() {
+      for ( unsigned int i = nextHandler++ ; i < handlers.size() ; i = nextHandler++ ) {
+        try {
+          handlers[i]->index() ;
+        }
+        catch( ... ) {
+          errors[i] = std::current_exception() ;
+        }
+      }
+    } ;
+
+    std::vector<std::thread> threads ;
+
+    for ( unsigned int t=1 ; t<nThreads ; t++ ) {
+      threads.emplace_back( worker ) ;
+    }
+
+    worker() ;
+
+    for ( auto& thread : threads ) {
+      thread.join() ;
+    }
+
+    // report in file list order, whatever the order the files were indexed in
+    for ( unsigned int i=0 ; i<handlers.size() ; i++ ) {
+      if( nullptr != errors[i] ) {
+        std::rethrow_exception( errors[i] ) ;
+      }
+      streamlog_out( MESSAGE ) << "*** Opened file for overlay : " << handlers[i]->getFileName() 
+                               << ", number of available events: " << handlers[i]->getNumberOfEvents() << std::endl ;
+    }
+  }
+  
   //===========================================================================================================================
   
   unsigned int Overlay::getNAvailableEvents() const
   {
     unsigned int totalNEvents(0);
     
-    for ( auto &handler : _lcFileHandlerList ) {
-      totalNEvents += handler.getNumberOfEvents();
+    for ( auto &source : _sources ) {
+      totalNEvents += source.nAvailableEvents;
     }
     
     return totalNEvents;
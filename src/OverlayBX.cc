@@ -1,21 +1,25 @@
 #define BGNAME "expBG"
 
 #include "OverlayBX.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <exception>
 #include <iostream>
+#include <thread>
+
+#include <sys/resource.h>
 
 #include <marlin/Global.h>
 #include "marlin/ProcessorEventSeeder.h"
-#ifdef MARLIN_USE_AIDA
-#include <marlin/AIDAProcessor.h>
-#include <AIDA/IHistogramFactory.h>
-#include <AIDA/ICloud1D.h>
-//#include <AIDA/IHistogram1D.h>
-#endif
 
 #include "IO/LCReader.h"
 #include "IO/LCWriter.h"
+#include "IOIMPL/LCFactory.h"
 #include <EVENT/LCCollection.h>
 #include <IMPL/LCCollectionVec.h>
+#include <IMPL/LCEventImpl.h>
 #include <EVENT/MCParticle.h>
 #include "IO/LCReader.h"
 //#include <EVENT/SimTrackerHit.h>
@@ -24,6 +28,7 @@
 #include <IMPL/LCFlagImpl.h>
 #include "UTIL/LCTOOLS.h"
 #include "UTIL/CellIDDecoder.h"
+#include "UTIL/BitField64.h"
 #include "UTIL/LCTrackerConf.h"
 #include "Merger.h"
 
@@ -50,6 +55,23 @@ namespace overlay{
   OverlayBX aOverlayBX ;
 
 
+  /** the 64 bit cellID of a hit, as in the LCIO encoding: cellID0 in the low word */
+  inline unsigned long long cellID64( const SimTrackerHit* hit ){
+    return (unsigned long long) (unsigned) hit->getCellID0() | ( (unsigned long long) (unsigned) hit->getCellID1() << 32 ) ;
+  }
+
+
+  void CellIDField::init( const std::string& encoding , unsigned index ){
+
+    // the string based decoder is only used here
+    BitField64 bf( encoding ) ;
+
+    offset = bf[index].offset() ;
+    width = bf[index].width() ;
+    isSigned = bf[index].isSigned() ;
+  }
+
+
   OverlayBX::OverlayBX() : Processor("OverlayBX") {
 
     // modify processor description
@@ -84,6 +106,33 @@ namespace overlay{
 				_eventsPerBX ,
 				int(-1) ) ;
 
+    registerProcessorParameter( "MaxOpenFiles" , 
+				"Max number of background files (and readers) kept open between BXs, least recently used closed first - default: 64,"
+				" at most half the open file limit of the process" ,
+				_maxOpenFiles ,
+				int(64) ) ;
+
+    registerProcessorParameter( "ReadAheadBXs" , 
+				"Number of BXs read ahead by worker threads while merging, in BX order - default: 0, i.e. no read ahead",
+				_readAheadBXs ,
+				int(0) ) ;
+
+    registerOptionalParameter( "OccupancyCollections" , 
+			       "VXD and TPC collections for which the overlaid background hits are counted per layer"  ,
+			       _occupancyCollections ,
+			       StringVec() ) ;
+
+    registerProcessorParameter( "TPCTemplateMode" , 
+				"None: TPC background from the BX files, Generate: write the TPC background of each event to a template file,"
+				" Consume: overlay one random TPC template per event - default None" ,
+				_tpcTemplateModeName ,
+				std::string("None") ) ;
+
+    registerOptionalParameter( "TPCTemplateFiles" , 
+			       "TPC template file to write (Generate) or files to read (Consume)"  ,
+			       _tpcTemplateFiles ,
+			       StringVec() ) ;
+
     registerProcessorParameter( "BunchCrossingTime" , 
 				"time between bunch crossings [s] - default 3.0e-7 (300 ns)" ,
 				_bxTime_s ,
@@ -179,15 +228,76 @@ namespace overlay{
     Global::EVENTSEEDER->registerProcessor(this);
 
 
-    // create readers for background input files
-    _lcReaders.resize( _inputFileNames.size() ) ;
-  
-    for( unsigned i=0 ; i < _inputFileNames.size() ; ++i ) {
-    
-      _lcReaders[i] = LCFactory::getInstance()->createLCReader() ;
-    
-      //     streamlog_out( DEBUG4 ) << " opening file for overlay : " << _inputFileNames[i]  << std::endl ;
-      //     _lcReaders[i]->open( _inputFileNames[i]  ) ; 
+    // reader pool for the background input files, opened on first use
+    _bxFiles.clear() ;
+    _bxFiles.resize( _inputFileNames.size() ) ;
+    _nOpenFiles = 0 ;
+
+    // leave half of the process open file limit to the other files of the job
+    struct rlimit fileLimit ;
+
+    if( getrlimit( RLIMIT_NOFILE , &fileLimit ) == 0 && fileLimit.rlim_cur != RLIM_INFINITY ) {
+
+      const int maxFiles = std::max( 1 , int( std::min<rlim_t>( fileLimit.rlim_cur / 2 , 1 << 30 ) ) ) ;
+
+      if( _maxOpenFiles <= 0 || _maxOpenFiles > maxFiles ) {
+	streamlog_out( WARNING ) << "OverlayBX::init: MaxOpenFiles set to " << maxFiles 
+				 << ", half the open file limit of " << fileLimit.rlim_cur << std::endl ;
+	_maxOpenFiles = maxFiles ;
+      }
+    }
+
+    if( _tpcTemplateModeName == "None" ) {
+      _tpcTemplateMode = kNoTPCTemplates ;
+    } else if( _tpcTemplateModeName == "Generate" ) {
+      _tpcTemplateMode = kGenerateTPCTemplates ;
+    } else if( _tpcTemplateModeName == "Consume" ) {
+      _tpcTemplateMode = kConsumeTPCTemplates ;
+    } else {
+      throw Exception( "OverlayBX::init: invalid TPCTemplateMode " + _tpcTemplateModeName + ", must be None, Generate or Consume" ) ;
+    }
+
+    if( _tpcTemplateMode != kNoTPCTemplates && _tpcTemplateFiles.empty() ) {
+      throw Exception( "OverlayBX::init: TPCTemplateFiles must be given with TPCTemplateMode " + _tpcTemplateModeName ) ;
+    }
+
+    if( _tpcTemplateMode == kGenerateTPCTemplates ) {
+
+      // templates are rotated when consumed
+      if( _phiRotateTPCHits ) {
+	streamlog_out( WARNING ) << "OverlayBX::init: PhiRotateTPCHits is ignored when generating TPC templates" << std::endl ;
+	_phiRotateTPCHits = false ;
+      }
+
+      _tpcTemplateWriter.reset( LCFactory::getInstance()->createLCWriter() ) ;
+      _tpcTemplateWriter->open( _tpcTemplateFiles[0] , LCIO::WRITE_NEW ) ;
+
+      streamlog_out( MESSAGE ) << " writing TPC background templates to " << _tpcTemplateFiles[0] << std::endl ;
+    }
+
+    _tpcTemplateInputs.clear() ;
+
+    if( _tpcTemplateMode == kConsumeTPCTemplates ) {
+      for( const auto& fileName : _tpcTemplateFiles ) 
+	_tpcTemplateInputs.push_back( BackgroundFileRegistry::instance().acquire( fileName ) ) ;
+    }
+
+    // with TPC templates, the BXs are merged without drawing random numbers
+    if( _readAheadBXs > 0 && _phiRotateTPCHits && _tpcTemplateMode != kConsumeTPCTemplates ) {
+      streamlog_out( WARNING ) << "OverlayBX::init: ReadAheadBXs can not be used with PhiRotateTPCHits, reading BXs one after the other" << std::endl ;
+      _readAheadBXs = 0 ;
+    }
+
+    if( _readAheadBXs > 0 && ! LCIO_VERSION_GE( 2 , 13 ) ) {
+      streamlog_out( WARNING ) << "OverlayBX::init: reading BXs ahead requires LCIO v2.13 or higher, reading BXs one after the other" << std::endl ;
+      _readAheadBXs = 0 ;
+    }
+
+    // the BX merged and the BXs read ahead each hold a file and a reader
+    if( _readAheadBXs > 0 && _maxOpenFiles > 0 && 2 * ( _readAheadBXs + 1 ) > _maxOpenFiles ) {
+      _readAheadBXs = std::max( 0 , _maxOpenFiles / 2 - 1 ) ;
+      streamlog_out( WARNING ) << "OverlayBX::init: ReadAheadBXs reduced to " << _readAheadBXs 
+			       << " to keep at most MaxOpenFiles = " << _maxOpenFiles << " files open" << std::endl ;
     }
   
     //-----  preparing collection map for detectors where on BX is overlayed  ----------
@@ -213,6 +323,10 @@ namespace overlay{
     
     }
   
+    // FPCCD pixel geometry for LCGenericObject merges, default if no VXD in GEAR
+    MergeOptions mergeOptions ;
+    setPixelGeometryFromGear( mergeOptions ) ;
+    _mergeContext.setOptions( mergeOptions ) ;
   
     // --- now preparing tpc collecitons map for merge -----------------
     endIt = _tpcCollections.end();
@@ -235,9 +349,20 @@ namespace overlay{
       streamlog_out( DEBUG ) << "    " << *it << std::endl ;
     }
 
+    _tpcDestNames.clear() ;
+
+    for( const auto& tpc : _tpcMap ) {
+      if( std::find( _tpcDestNames.begin(), _tpcDestNames.end(), tpc.second ) == _tpcDestNames.end() ) 
+	_tpcDestNames.push_back( tpc.second ) ;
+    }
+
     //---------------------------------------------------------------------
   
     init_geometry() ; 
+
+    _trackerLayerField.init( LCTrackerCellID::encoding_string() , LCTrackerCellID::layer() ) ;
+
+    _occupancy.setCollections( _occupancyCollections ) ;
   
   
     streamlog_out( MESSAGE ) << " --- pair background in VXD detector : " << std::endl ;
@@ -249,7 +374,8 @@ namespace overlay{
     }
 
 
-    // FIXME: do the TPC intialization also in the init() method ...
+    // TPC half length: the number of TPC BXs and the drift volume of the shifted hits
+    _tpcHalfLength = Global::GEAR->getTPCParameters().getMaxDriftLength() ;
 
 
     _nRun = 0 ;
@@ -336,19 +462,11 @@ namespace overlay{
   
     if( bxNum != _lastBXNum ) {
     
-      // open a new reader .....
+      // switch to a random reader of the pool: a seek, the file is only opened if not in the pool
     
-      int nRdr = _lcReaders.size() ;
+      int nRdr = _bxFiles.size() ;
       int iRdr = (int) ( CLHEP::RandFlat::shoot() * nRdr ) ; 
     
-      if( _currentRdr != -1 ) {
-      
-	_lcReaders[_currentRdr]->close() ; 
-      
-	streamlog_out( DEBUG ) << " >>>> closing reader " << _currentRdr 
-			       << " of " << nRdr  << std::endl ;
-      }
-    
       streamlog_out( DEBUG4 ) << " >>>> reading next BX  from reader " << iRdr 
 			      << " of " << nRdr  
 			      << " for BX : " << bxNum 
@@ -357,14 +475,30 @@ namespace overlay{
 
       _currentRdr = iRdr ;
 
-      _lcReaders[_currentRdr]->open( _inputFileNames[_currentRdr]  ) ; 
+      BackgroundFile& bgFile = openBXFile( _currentRdr ) ;
+      BXFile& bxFile = _bxFiles[_currentRdr] ;
+
+      // files with several BXs: take the next one, start again at the first one after the last
+      if( bxFile.nextEvent >= bgFile.getNumberOfEvents() ) {
+	bxFile.nextEvent = 0 ;
+      }
+
+      _bxFirstEvent = bxFile.nextEvent ;
+      bxFile.nextEvent = std::min<unsigned long>( (unsigned long) _bxFirstEvent + _eventsPerBX , bgFile.getNumberOfEvents() ) ;
 
       _lastEvent = -1 ;
 
       _lastBXNum = bxNum ;
+
+      ++_nBXsRead ;
     }
 
-    LCEvent* evt =  _lcReaders[_currentRdr]->readNextEvent( LCIO::UPDATE ) ;
+    BackgroundFile& bgFile = *_bxFiles[_currentRdr].file ;
+    const unsigned int index = _bxFirstEvent + _lastEvent + 1 ;
+
+    // consecutive events of a BX are streamed, see BackgroundFile::readEventAt()
+    LCEvent* evt = ( index < bgFile.getNumberOfEvents() ) ? 
+      bgFile.readEventAt( index , _bxReadCollections.empty() ? 0 : &_bxReadCollections ) : 0 ;
     
     if( evt == 0 ) {
       _lastBXNum = -1 ;
@@ -376,6 +510,254 @@ namespace overlay{
   }
 
 
+  BackgroundFile& OverlayBX::openBXFile( int iFile ){
+
+    BXFile& bxFile = _bxFiles[iFile] ;
+    bxFile.lastUse = ++_nFileUses ;
+
+    if( bxFile.file ) 
+      return *bxFile.file ;
+
+    // close the least recently used files if the pool is full
+    closeBXFiles( 1 , iFile ) ;
+
+    // shared with other processors reading the same file, opened and indexed on first use
+    bxFile.file = BackgroundFileRegistry::instance().acquire( _inputFileNames[iFile] ) ;
+    ++_nOpenFiles ;
+    ++_nFileOpens ;
+
+    return *bxFile.file ;
+  }
+
+
+  void OverlayBX::closeBXFiles( int nNeeded, int keepFile ){
+
+    if( _maxOpenFiles <= 0 ) 
+      return ;
+
+    // idle readers of a file count as open files too, they are closed with it.
+    // Files of BXs read ahead are kept, see prepareBXLoads()
+    while( _nOpenFiles + nNeeded > _maxOpenFiles ) {
+
+      BXFile* lru = 0 ;
+
+      for( auto& f : _bxFiles ) {
+	if( f.file && f.nLoads == 0 && &f != &_bxFiles[keepFile] && ( lru == 0 || f.lastUse < lru->lastUse ) )
+	  lru = &f ;
+      }
+
+      if( lru == 0 ) 
+	return ;
+
+      streamlog_out( DEBUG ) << " >>>> closing reader " << ( lru - &_bxFiles[0] ) 
+			     << " of " << _bxFiles.size() << std::endl ;
+      lru->file.reset() ;
+      for( auto& reader : lru->readers ) 
+	reader->close() ;
+      _nOpenFiles -= 1 + int( lru->readers.size() ) ;
+      lru->readers.clear() ;
+    }
+  }
+
+
+  void OverlayBX::planBXLoads( int numBX ){
+
+    // BXs left by an event that failed: release their files and readers
+    for( auto& load : _bxLoads ) {
+      if( load.file ) 
+	releaseBXLoad( load ) ;
+    }
+
+    // draw the files in BX order, as readNextEvent() does: same random numbers
+    _bxLoads.clear() ;
+    _bxLoads.resize( numBX ) ;
+
+    int nRdr = _bxFiles.size() ;
+
+    for( int i=0 ; i < numBX ; ++i ){
+
+      BXLoad& load = _bxLoads[i] ;
+      load.iFile = (int) ( CLHEP::RandFlat::shoot() * nRdr ) ; 
+
+      streamlog_out( DEBUG4 ) << " >>>> reading ahead BX : " << i << " from reader " << load.iFile 
+			      << " of " << nRdr << std::endl ;
+    }
+
+    _lastBXNum = -1 ;
+  }
+
+
+  void OverlayBX::prepareBXLoads( int firstBX, int endBX ){
+
+    // only the files of the BXs read ahead are held: they are not closed until their BX is merged
+    std::vector<BackgroundFile*> files ;
+
+    for( int i=firstBX ; i < endBX ; ++i ){
+
+      BXLoad& load = _bxLoads[i] ;
+
+      openBXFile( load.iFile ) ;
+      ++_bxFiles[load.iFile].nLoads ;
+      load.file = _bxFiles[load.iFile].file ;
+
+      if( files.end() == std::find( files.begin(), files.end(), load.file.get() ) )
+	files.push_back( load.file.get() ) ;
+    }
+
+    // index the files not yet open with worker threads, see Overlay::indexInputFiles()
+    unsigned int nThreads = std::min( static_cast<unsigned int>( _readAheadBXs ), static_cast<unsigned int>( files.size() ) ) ;
+
+    LCFactory::getInstance() ;
+
+    std::atomic<unsigned int> nextFile(0) ;
+    std::vector<std::exception_ptr> errors( files.size() ) ;
+
+    auto worker = [&]() {
+      for ( unsigned int i = nextFile++ ; i < files.size() ; i = nextFile++ ) {
+	try {
+	  files[i]->index() ;
+	}
+	catch( ... ) {
+	  errors[i] = std::current_exception() ;
+	}
+      }
+    } ;
+
+    std::vector<std::thread> threads ;
+
+    for ( unsigned int t=1 ; t<nThreads ; t++ ) {
+      threads.emplace_back( worker ) ;
+    }
+
+    worker() ;
+
+    for ( auto& thread : threads ) {
+      thread.join() ;
+    }
+
+    for ( auto& error : errors ) {
+      if( nullptr != error ) {
+	std::rethrow_exception( error ) ;
+      }
+    }
+
+    // the events of each BX, as in readNextEvent(): files with several BXs are read in turn
+    for( int i=firstBX ; i < endBX ; ++i ){
+
+      BXLoad& load = _bxLoads[i] ;
+      BXFile& bxFile = _bxFiles[load.iFile] ;
+      const unsigned int nEvents = load.file->getNumberOfEvents() ;
+
+      if( bxFile.nextEvent >= nEvents ) {
+	bxFile.nextEvent = 0 ;
+      }
+
+      load.firstEvent = bxFile.nextEvent ;
+      load.endEvent = std::min<unsigned long>( (unsigned long) load.firstEvent + _eventsPerBX , nEvents ) ;
+      bxFile.nextEvent = load.endEvent ;
+
+      ++_nBXsRead ;
+    }
+  }
+
+
+  void OverlayBX::bxCollectionNames( int bxNum, int nVXDBX, int nTPCBX, StringVec& names ) const {
+
+    names.clear() ;
+
+    // the pair MCParticles are merged for all BXs and the hits keep pointing to them
+    if( _keepPairsTruthInfo ) 
+      return ;
+
+    if( bxNum < nVXDBX ) 
+      names.push_back( _vxdCollection ) ;
+
+    if( bxNum < nTPCBX ) {
+      for( const auto& tpc : _tpcMap ) 
+	names.push_back( tpc.first ) ;
+    }
+
+    if( bxNum == 0 ) {
+      for( const auto& col : _colMap ) 
+	names.push_back( col.first ) ;
+    }
+  }
+
+
+  std::future<void> OverlayBX::startBXLoad( int bxNum ){
+
+    BXLoad& load = _bxLoads[bxNum] ;
+    BXFile& bxFile = _bxFiles[load.iFile] ;
+
+    // reuse an idle reader of the file, if any
+    if( ! bxFile.readers.empty() ) {
+      load.reader = std::move( bxFile.readers.back() ) ;
+      bxFile.readers.pop_back() ;
+    } else {
+      // a new reader is opened by the worker thread
+      closeBXFiles( 1 , load.iFile ) ;
+      ++_nOpenFiles ;
+    }
+
+    return std::async( std::launch::async, [&load]() {
+
+	if( ! load.reader ) {
+	  load.reader.reset( LCFactory::getInstance()->createLCReader( LCReader::directAccess ) ) ;
+	  load.reader->open( load.file->getFileName() ) ;
+	}
+
+	load.reader->setReadCollectionNames( load.collections ) ;
+
+	load.event = 0 ;
+
+	if( load.firstEvent < load.endEvent ) {
+	  load.event = load.reader->readEvent( load.file->getRunNumber( load.firstEvent ), 
+					       load.file->getEventNumber( load.firstEvent ), LCIO::UPDATE ) ;
+	}
+      } ) ;
+  }
+
+
+  LCEvent* OverlayBX::readBXEvent( BXLoad& load, long iEvt ){
+
+    if( iEvt == 0 ) 
+      return load.event ;
+
+    const unsigned long index = load.firstEvent + iEvt ;
+
+    if( index >= load.endEvent ) 
+      return 0 ;
+
+    // further events of the BX are read here, once the previous one is merged
+    load.event = load.reader->readEvent( load.file->getRunNumber( index ), load.file->getEventNumber( index ), LCIO::UPDATE ) ;
+
+    return load.event ;
+  }
+
+
+  void OverlayBX::releaseBXLoad( BXLoad& load ){
+
+    BXFile& bxFile = _bxFiles[load.iFile] ;
+
+    if( load.file ) 
+      --bxFile.nLoads ;
+
+    // keep the reader for a later BX from this file, unless the file has been closed meanwhile
+    if( bxFile.file && load.reader ) {
+      bxFile.readers.push_back( std::move( load.reader ) ) ;
+    }
+
+    if( load.reader ) {
+      load.reader->close() ;
+      load.reader.reset() ;
+      --_nOpenFiles ;
+    }
+
+    load.file.reset() ;
+    load.event = 0 ;
+  }
+
+
   // LCEvent*  OverlayBX::readNextEvent(){
   //   int nRdr = _lcReaders.size() ;
   //   int iRdr = (int) ( CLHEP::RandFlat::shoot() * nRdr ) ; 
@@ -421,8 +803,7 @@ namespace overlay{
     }
   
     //---- get number of BXs to be overlaid in TPC 
-    const gear::TPCParameters& gearTPC = Global::GEAR->getTPCParameters() ;
-    double tpcHalfLength = gearTPC.getMaxDriftLength()  ;
+    double tpcHalfLength = _tpcHalfLength ;
 
     // drift length per bunch crossing
     double drLenBX = _bxTime_s * _tpcVdrift_mm_s ; 
@@ -442,6 +823,10 @@ namespace overlay{
 
     }
 
+    // the TPC background comes from a template, no BX is read for the TPC
+    if( _tpcTemplateMode == kConsumeTPCTemplates ) 
+      nTPCBX = 0 ;
+
     //-----------------------------------
   
 
@@ -540,12 +925,68 @@ namespace overlay{
     int nVXDHits = 0 ;
     int nTPCHits = 0 ;
 
+    // when generating templates, the TPC background is merged into the template event instead
+    std::unique_ptr<LCEventImpl> templateEvt ;
+
+    if( _tpcTemplateMode == kGenerateTPCTemplates ) {
+
+      templateEvt.reset( new LCEventImpl ) ;
+      templateEvt->setRunNumber( evt->getRunNumber() ) ;
+      templateEvt->setEventNumber( evt->getEventNumber() ) ;
+
+      for( const auto& tpcName : _tpcDestNames ) {
+
+	LCCollection* tpcCol = new LCCollectionVec( LCIO::SIMTRACKERHIT )  ;
+      
+	LCFlagImpl thFlag(0) ;
+	thFlag.setBit( LCIO::THBIT_MOMENTUM ) ;
+	tpcCol->setFlag( thFlag.getFlag()  ) ;
+
+	templateEvt->addCollection(  tpcCol , tpcName  ) ;
+      }
+    }
+
+    LCEvent* tpcEvt = ( templateEvt ? templateEvt.get() : evt ) ;
+
+    // read the next BXs with worker threads while merging, the BXs are still merged in order
+    const bool readAhead = ( _readAheadBXs > 0 && numBX > 1 ) ;
+    std::deque< std::future<void> > bxReads ;
+
+    if( readAhead ) {
+
+      planBXLoads( numBX ) ;
+
+      for(int k = 0 ; k < numBX ; k++ ) 
+	bxCollectionNames( k , nVXDBX , nTPCBX , _bxLoads[k].collections ) ;
+
+      prepareBXLoads( 0 , std::min( _readAheadBXs , numBX ) ) ;
+
+      for(int k = 0 ; k < std::min( _readAheadBXs , numBX ) ; k++ ) 
+	bxReads.push_back( startBXLoad( k ) ) ;
+    }
+
     for(int i = 0  ; i < numBX  ; i++ ) {
 
+      if( readAhead ) {
+
+	bxReads.front().get() ;  // rethrows read errors
+	bxReads.pop_front() ;
+
+	if( i + _readAheadBXs < numBX ) {
+	  prepareBXLoads( i + _readAheadBXs , i + _readAheadBXs + 1 ) ;
+	  bxReads.push_back( startBXLoad( i + _readAheadBXs ) ) ;
+	}
+
+      } else {
+
+	// only decode the collections merged for this BX
+	bxCollectionNames( i , nVXDBX , nTPCBX , _bxReadCollections ) ;
+      }
+
       // loop over events in one BX ......
       for(long j=0; j < _eventsPerBX  ; j++ ) {
 
-	LCEvent* olEvt  = readNextEvent(i) ;
+	LCEvent* olEvt  = readAhead ? readBXEvent( _bxLoads[i] , j ) : readNextEvent(i) ;
       
 	if( olEvt == 0 ) 
 	  break ;
@@ -573,7 +1014,7 @@ namespace overlay{
 	  LCCollection* vxdBGCol = olEvt->getCollection( _vxdCollection ) ;
 	
 	  if( i < nVXDBX )
-	    nVXDHits += mergeVXDColsFromBX( vxdCol , vxdBGCol , i )  ;
+	    nVXDHits += mergeVXDColsFromBX( vxdCol , vxdBGCol , i , _occupancy.index( _vxdCollection ) )  ;
  
 	} catch( DataNotAvailableException& e) {}
       
@@ -585,12 +1026,12 @@ namespace overlay{
 	
 	  try { 
 	  
-	    LCCollection* tpcCol   = evt->getCollection( tpcName ) ;
+	    LCCollection* tpcCol   = tpcEvt->getCollection( tpcName ) ;
 	    LCCollection* tpcBGCol = olEvt->getCollection( tpcBGName ) ;
 	  
 	    //overlay TPC hits shifted by nBX * drLenBX
 	    if( i < nTPCBX )
-	      nTPCHits += mergeTPCColsFromBX( tpcCol , tpcBGCol ,  zShiftStart + i * drLenBX   )  ;
+	      nTPCHits += mergeTPCColsFromBX( tpcCol , tpcBGCol ,  zShiftStart + i * drLenBX , _occupancy.index( tpcName ) )  ;
 	    //nTPCHits += mergeTPCColsFromBX( tpcCol , tpcBGCol ,  0  )  ; // no z shift for testing
 	  
 	  } catch( DataNotAvailableException& e) {}
@@ -638,12 +1079,27 @@ namespace overlay{
 	  }
 
 
-	  Merger::merge( olEvt, evt, &_colMap ) ;
+	  Merger::merge( olEvt, evt, &_colMap, &_mergeContext ) ;
 	}
       
       }
+
+      if( readAhead ) 
+	releaseBXLoad( _bxLoads[i] ) ;
     }
   
+    if( templateEvt ) {
+
+      _tpcTemplateWriter->writeEvent( templateEvt.get() ) ;
+      ++_nTPCTemplates ;
+    }
+
+    if( _tpcTemplateMode == kConsumeTPCTemplates ) 
+      nTPCHits += mergeTPCTemplate( evt ) ;
+
+    // pack the accumulated pixel hits, once per event
+    _mergeContext.flush() ;
+  
     streamlog_out( DEBUG3 ) << " total number of VXD bg hits: " << nVXDHits 
 			    << std::endl ;
     
@@ -651,15 +1107,14 @@ namespace overlay{
     if( streamlog_level(DEBUG3) ) 
       LCTOOLS::dumpEvent( evt ) ;
 
+    _occupancy.endEvent( evt , name() + "_nBgHits_" ) ;
 
     _nEvt ++ ;
   }
 
 
-  int OverlayBX::mergeVXDColsFromBX( LCCollection* vxdCol , LCCollection* vxdBGCol , int bxNum ) {
+  int OverlayBX::mergeVXDColsFromBX( LCCollection* vxdCol , LCCollection* vxdBGCol , int bxNum , int monitorIndex ) {
   
-    static CellIDDecoder<SimTrackerHit> idDec( LCTrackerCellID::encoding_string() ) ;
-
     // the hits are simply overlaid - no shift in r-phi along the ladder 
     // is applied; this should be ok if the ladders are not read out along z
     // - in reality the innermost ladders will have faster readout than outermost ladders
@@ -681,23 +1136,34 @@ namespace overlay{
       nHits = vxdBGCol->getNumberOfElements();
     
       streamlog_out( DEBUG1 ) << " merging VXD hits from bg : " << nHits << endl;
+
+      // decode the layers of all hits first ...
+      const int nBGHits = nHits ;
+      _vxdHitLayers.resize( nBGHits ) ;
+
+      for (int i=0; i<nBGHits; i++){ 
+	_vxdHitLayers[i] = _trackerLayerField( cellID64( static_cast<SimTrackerHit*>( vxdBGCol->getElementAt(i) ) ) ) ;
+      }
+
+      // ... and the layers overlaying this BX
+      _vxdLayerAccept.resize( _vxdLayers.size() ) ;
+
+      for( unsigned l=0 ; l < _vxdLayers.size() ; ++l ){
+	_vxdLayerAccept[l] = ( bxNum < _vxdLayers[l].nBX ) ;
+      }
+
+      const long long nLayers = _vxdLayerAccept.size() ;
     
-      for (int i=nHits-1; i>=0; i--){ 
+      for (int i=nBGHits-1; i>=0; i--){ 
 	// loop from back in order to remove vector elements from end ...
-      
-	//      SimTrackerHit* sth = dynamic_cast<SimTrackerHit*>(  vxdBGCol->getElementAt(i) ) ;
-	//LCObject* bgHit = vxdBGCol->getElementAt(i) ;
 
 	SimTrackerHitImpl* bgHit = dynamic_cast<SimTrackerHitImpl*>( vxdBGCol->getElementAt(i) ) ;
 
 	vxdBGCol->removeElementAt(i);
 
+	const long long layer = _vxdHitLayers[i] ;
 
-	//      int layer = ( bgHit->getCellID() & 0xff )  ;
-	int layer =  idDec( bgHit )[ LCTrackerCellID::layer() ] ;
-
-
-	if( bxNum < _vxdLayers[ layer ].nBX  ) {
+	if( layer >= 0 && layer < nLayers && _vxdLayerAccept[ layer ] ) {
 	
 	  // explicitly set a null pointer as MCParticle collection is not merged 
 	  if (  _keepPairsTruthInfo == false ) {
@@ -705,6 +1171,9 @@ namespace overlay{
 	  }
 	  vxdCol->addElement( bgHit );
 
+	  if( monitorIndex >= 0 ) 
+	    _occupancy.add( monitorIndex , layer ) ;
+
 	} else {
 
 	  nHits -- ;
@@ -726,15 +1195,60 @@ namespace overlay{
   //------------------------------------------------------------------------------------------------
 
 
-  int OverlayBX::mergeTPCColsFromBX( LCCollection* tpcCol , LCCollection* tpcBGCol , float zPosShift ) {
+  int OverlayBX::mergeTPCTemplate( LCEvent* evt ) {
+
+    // a random template of a random file
+    int nFiles = _tpcTemplateInputs.size() ;
+    int iFile = (int) ( CLHEP::RandFlat::shoot() * nFiles ) ;
+
+    BackgroundFile& file = *_tpcTemplateInputs[ iFile ] ;
+    int nTemplates = file.getNumberOfEvents() ;
+
+    if( nTemplates == 0 ) {
+      streamlog_out( WARNING ) << " no TPC template in file " << file.getFileName() << std::endl ;
+      return 0 ;
+    }
+
+    int index = (int) ( CLHEP::RandFlat::shoot() * nTemplates ) ;
+
+    LCEvent* tplEvt = file.readEventAt( index , &_tpcDestNames ) ;
+
+    if( tplEvt == 0 ) 
+      return 0 ;
+
+    streamlog_out( DEBUG1 ) << " overlay TPC template " << tplEvt->getRunNumber() << "  - "
+			    << tplEvt->getEventNumber() << " from file " << file.getFileName() << std::endl ;
+
+    ++_nTPCTemplates ;
+
+    int nHits = 0 ;
+
+    for( const auto& tpcName : _tpcDestNames ) {
+
+      try { 
+	  
+	LCCollection* tpcCol = evt->getCollection( tpcName ) ;
+	LCCollection* tplCol = tplEvt->getCollection( tpcName ) ;
+
+	// already shifted and clipped to the drift volume: only rotated, with PhiRotateTPCHits
+	nHits += mergeTPCColsFromBX( tpcCol , tplCol , 0. , _occupancy.index( tpcName ) ) ;
+	  
+      } catch( DataNotAvailableException& e) {}
+    }
+
+    return nHits ;
+  }
+
+
+  //------------------------------------------------------------------------------------------------
+
+
+  int OverlayBX::mergeTPCColsFromBX( LCCollection* tpcCol , LCCollection* tpcBGCol , float zPosShift , int monitorIndex ) {
   
     // hits are overlayed shifted in z according to the drift distance per bunch crossing  
-    // ...
-  
-    //  const gear::TPCParameters& gearTPC = Global::GEAR->getTPCParameters() ;
-    // TPC half length
-    double tpcHLen = Global::GEAR->getTPCParameters().getMaxDriftLength()  ;
+    // and optionally rotated in phi - both applied to all hits of the BX at once
 
+    const double tpcHLen = _tpcHalfLength ;
 
     const string destType = tpcCol->getTypeName();
     int nHits = 0 ;
@@ -754,82 +1268,73 @@ namespace overlay{
 
     if ( destType == LCIO::SIMTRACKERHIT  )  {
     
-      // running trough all the elements in the collection.
-      nHits = tpcBGCol->getNumberOfElements();
-    
-      streamlog_out( DEBUG1 ) << " merging TPC hits from bg : " << nHits << endl;
+      const int nBGHits = tpcBGCol->getNumberOfElements();
     
-      for (int i=nHits-1; i>=0; i--){ 
+      streamlog_out( DEBUG1 ) << " merging TPC hits from bg : " << nBGHits << endl;
+
+      _tpcX.resize( nBGHits ) ;
+      _tpcY.resize( nBGHits ) ;
+      _tpcZ.resize( nBGHits ) ;
+      _tpcAccept.resize( nBGHits ) ;
+
+      // gather the positions first: the getters are virtual
+      for (int i=0; i<nBGHits; i++){ 
+	const double* pos = static_cast<SimTrackerHit*>( tpcBGCol->getElementAt(i) )->getPosition() ;
+	_tpcX[i] = pos[0] ;
+	_tpcY[i] = pos[1] ;
+	_tpcZ[i] = pos[2] ;
+      }
+
+      // rotation (identity if not rotating), z shift away from the cathode and drift volume check 
+      // in one branch free, vectorisable pass
+      const double cosRot = ( _phiRotateTPCHits ? std::cos( phiRot ) : 1. ) ;
+      const double sinRot = ( _phiRotateTPCHits ? std::sin( phiRot ) : 0. ) ;
+      const double shift = zPosShift ;
+
+      double* x = _tpcX.data() ;
+      double* y = _tpcY.data() ;
+      double* z = _tpcZ.data() ;
+      unsigned char* accept = _tpcAccept.data() ;
+
+      for (int i=0; i<nBGHits; i++){ 
+	const double xi = x[i] ;
+	const double yi = y[i] ;
+	const double side = ( z[i] > 0 ? 1. : -1. ) ;  // z = 0 belongs to the negative side
+	const double zi = z[i] + side * shift ;
+	const double dist = side * zi ;                 // distance to the cathode, on the side of the hit
+
+	x[i] = cosRot * xi - sinRot * yi ;
+	y[i] = sinRot * xi + cosRot * yi ;
+	z[i] = zi ;
+	accept[i] = ( dist >= 0 ) & ( dist <= tpcHLen ) ;
+	nHits += accept[i] ;
+      }
+
+      for (int i=nBGHits-1; i>=0; i--){ 
 	// loop from back in order to remove vector elements from end ...
       
 	SimTrackerHitImpl* bgHit = dynamic_cast<SimTrackerHitImpl*>( tpcBGCol->getElementAt(i) ) ;
 
 	tpcBGCol->removeElementAt(i);
 
+	if( accept[i] ) {
 
+	  double newPos[3] = { x[i] , y[i] , z[i] } ;
 
-	//******************************************************
-      
-	const double* pos =  bgHit->getPosition() ;
-
-	gear::Vector3D posV( pos[0] , pos[1], pos[2] ) ;
-
-
-	if( _phiRotateTPCHits ){
-
-	  gear::Vector3D rotV( posV.rho() , posV.phi() + phiRot , posV.z() , gear::Vector3D::cylindrical ) ; 
-
-	  posV = rotV ;
-
-	}
-
-	double newPos[3] ;
-	newPos[0] = posV[0] ;
-	newPos[1] = posV[1] ;
-	newPos[2] = posV[2] ;
-
-
-	if( newPos[2] >  0 ) { // positive z
-	
-	  newPos[2] += zPosShift ;   
-	
-	  if( newPos[2] >= 0 && newPos[2] <= tpcHLen ){
+	  bgHit->setPosition(  newPos ) ;
 	  
-	    bgHit->setPosition(  newPos ) ;
+	  bgHit->setMCParticle( 0 ) ;
 	  
-	    bgHit->setMCParticle( 0 ) ;
-	  
-	    tpcCol->addElement( bgHit );
-
-	  } else {
+	  tpcCol->addElement( bgHit );
 
+	  if( monitorIndex >= 0 ) 
+	    _occupancy.add( monitorIndex , _trackerLayerField( cellID64( bgHit ) ) ) ;
 
-	    nHits -- ;
-	    // if hit not added we need to delete it as we removed from the collection (vector) 
-	    delete bgHit ;
-	  }
- 
-	} else {  // negative z
-	
-	  newPos[2] -= zPosShift ;
-	
-	  if( newPos[2] <= 0 && newPos[2] >= -tpcHLen ){
-	  
-	    bgHit->setPosition(  newPos ) ;
-	  
-	    bgHit->setMCParticle( 0 ) ;
-	  
-	    tpcCol->addElement( bgHit );
-	  
-	  } else {
+	} else {
 
-	    nHits -- ;
-	    // if hit not added we need to delete it as we removed from the collection (vector) 
-	    delete bgHit ;
-	  }
+	  // if hit not added we need to delete it as we removed from the collection (vector) 
+	  delete bgHit ;
 	}
-	//******************************************************
-
       }
 
     } else {
@@ -842,122 +1347,34 @@ namespace overlay{
   }
 
 
-  void OverlayBX::check( LCEvent * evt ) { 
-
-    static CellIDDecoder<SimTrackerHit> idDec( LCTrackerCellID::encoding_string() ) ;
-
-
-#ifdef MARLIN_USE_AIDA
-    struct H1D{
-      enum { 
-	hitsLayer1,
-	hitsLayer2,
-	hitsLayer3,
-	hitsLayer4,
-	hitsLayer5,
-	hitsLayer6,
-	size 
-      }  ;
-    };
-
-    if( isFirstEvent() ) {
-    
-      _hist1DVec.resize( H1D::size )   ;
-    
-      float  hitMax =  100000. ;
-      _hist1DVec[ H1D::hitsLayer1 ] = AIDAProcessor::histogramFactory(this)->createHistogram1D( "hitsLayer1", 
-												"hits Layer 1", 
-												100, 0. ,hitMax ) ; 
-      _hist1DVec[ H1D::hitsLayer2 ] = AIDAProcessor::histogramFactory(this)->createHistogram1D( "hitsLayer2", 
-												"hits Layer 2", 
-												100, 0. , hitMax ) ; 
-      _hist1DVec[ H1D::hitsLayer3 ] = AIDAProcessor::histogramFactory(this)->createHistogram1D( "hitsLayer3", 
-												"hits Layer 3", 
-												100, 0. , hitMax ) ; 
-      _hist1DVec[ H1D::hitsLayer4 ] = AIDAProcessor::histogramFactory(this)->createHistogram1D( "hitsLayer4", 
-												"hits Layer 4", 
-												100, 0. ,hitMax ) ; 
-      _hist1DVec[ H1D::hitsLayer5 ] = AIDAProcessor::histogramFactory(this)->createHistogram1D( "hitsLayer5", 
-												"hits Layer 5", 
-												100, 0. , hitMax ) ; 
-      _hist1DVec[ H1D::hitsLayer6 ] = AIDAProcessor::histogramFactory(this)->createHistogram1D( "hitsLayer6", 
-												"hits Layer 6", 
-												100, 0. , hitMax ) ; 
-    }
-#endif
-
-
-
-    LCCollection* vxdCol = 0 ; 
-
-    int nhit = 0 ;
-    int nHitL1 = 0 ;
-    int nHitL2 = 0 ;
-    int nHitL3 = 0 ;
-    int nHitL4 = 0 ;
-    int nHitL5 = 0 ;
-    int nHitL6 = 0 ;
-
+  void OverlayBX::end(){ 
   
-    try { 
-      vxdCol = evt->getCollection( _vxdCollection ) ;
-
-      int nH = vxdCol->getNumberOfElements() ;
-    
-
-      streamlog_out( MESSAGE4 ) <<  "  ++++ " << evt->getEventNumber() << "  " <<  nH << std::endl ; 
-
-
-      for(int i=0; i<nH ; ++i){
-      
-	SimTrackerHit* sth = dynamic_cast<SimTrackerHit*>(  vxdCol->getElementAt(i) ) ;
+    // close all open input files
+    _bxLoads.clear() ;
 
+    for( auto& bxFile : _bxFiles ) {
+      for( auto& reader : bxFile.readers ) 
+	reader->close() ;
+    }
 
-	int layer =  idDec( sth )[ LCTrackerCellID::layer() ] ;
-      
-	if     ( layer == 0 ) nHitL1++ ; 
-	else if( layer == 1 ) nHitL2++ ; 
-	else if( layer == 2 ) nHitL3++ ; 
-	else if( layer == 3 ) nHitL4++ ; 
-	else if( layer == 4 ) nHitL5++ ; 
-	else if( layer == 5 ) nHitL6++ ; 
-      
+    _bxFiles.clear() ;
+    _nOpenFiles = 0 ;
 
-	MCParticle* mcp = sth->getMCParticle() ;
-	if( mcp != 0  ){
-	  nhit++ ;
-	}
+    _tpcTemplateInputs.clear() ;
 
-      }
-      if( nhit != nH ) {
-	streamlog_out( ERROR ) << " found " << nhit << " MCParticles for " << nH 
-			       << " SimTrackerHits "  << std::endl ; 
-      } else {
-	streamlog_out( DEBUG ) << " OK ! - found " << nhit << " MCParticle links for " << nH 
-			       << " SimTrackerHits "  << std::endl ; 
-      }
-    
+    if( _tpcTemplateWriter ) {
+      _tpcTemplateWriter->close() ;
+      _tpcTemplateWriter.reset() ;
+    }
 
-    } catch( DataNotAvailableException& e) {}
-  
-#ifdef MARLIN_USE_AIDA
-    _hist1DVec[ H1D::hitsLayer1 ]->fill( nHitL1 ) ;
-    _hist1DVec[ H1D::hitsLayer2 ]->fill( nHitL2 ) ;
-    _hist1DVec[ H1D::hitsLayer3 ]->fill( nHitL3 ) ;
-    _hist1DVec[ H1D::hitsLayer4 ]->fill( nHitL4 ) ;
-    _hist1DVec[ H1D::hitsLayer5 ]->fill( nHitL5 ) ;
-    _hist1DVec[ H1D::hitsLayer6 ]->fill( nHitL6 ) ;
-#endif
-  
-  }
+    if( _tpcTemplateMode == kGenerateTPCTemplates ) 
+      streamlog_out( MESSAGE ) << " wrote " << _nTPCTemplates << " TPC background templates" << std::endl ;
 
+    if( _tpcTemplateMode == kConsumeTPCTemplates ) 
+      streamlog_out( MESSAGE ) << " overlayed " << _nTPCTemplates << " TPC background templates" << std::endl ;
 
-  void OverlayBX::end(){ 
-  
-    //   // close all open input files
-    //   for( unsigned i=0 ; i < _lcReaders.size() ; ++i ) {
-    //     _lcReaders[i]->close() ;
-    //   }
+    streamlog_out( MESSAGE ) << " read " << _nBXsRead << " BXs of background with " << _nFileOpens 
+			     << " file opens" << std::endl ;
 
     streamlog_out( MESSAGE ) << " overlayed pair background in VXD detector : " << std::endl ;
 
@@ -968,19 +1385,21 @@ namespace overlay{
 
       double area =  _vxdLayers[i].ladderArea * _vxdLayers[i].nLadders ;
 
+      const int iVXD = _occupancy.index( _vxdCollection ) ;
 
-#ifdef MARLIN_USE_AIDA
+      if( iVXD >= 0 ) {
 
-      streamlog_out( MESSAGE ) << " -> average number of hits:  " 
-			       <<  _hist1DVec[ i ]->mean() 
-			       << " -    hits/ mm " <<  _hist1DVec[ i ]->mean() / area  
-			       << " -    occupancy (25mu) " << _hist1DVec[ i ]->mean() / area / 1600. 
-			       << std::endl ;
-
-#endif
+	const double mean = _occupancy.getMean( iVXD , i ) ;
 
+	streamlog_out( MESSAGE ) << " -> average number of bg hits:  " 
+				 <<  mean
+				 << " -    hits/ mm " <<  mean / area  
+				 << " -    occupancy (25mu) " << mean / area / 1600. 
+				 << std::endl ;
+      }
     }
-  
+
+    _occupancy.print() ;
   }
 
 
@@ -72,6 +72,17 @@ namespace overlay{
     outEvt = new LCEventImpl();
     outEvt->setRunNumber(0);
     outEvt->setEventNumber(0);
+
+    // all the listed collections are merged in a collection with the same name
+    _mergedCollectionMap.clear();
+    for ( const auto& name : _mergedCollectionNames ) {
+      _mergedCollectionMap[ name ] = name;
+    }
+
+    // FPCCD pixel geometry for LCGenericObject merges, default if no VXD in GEAR
+    MergeOptions mergeOptions;
+    setPixelGeometryFromGear(mergeOptions);
+    _mergeContext.setOptions(mergeOptions);
         
     _nRun = 0 ;
     _nEvt = 0 ;
@@ -91,23 +102,9 @@ namespace overlay{
   void OverlayEvents::modifyEvent( LCEvent * evt ) {
   
     //int activeRunNumber = evt->getRunNumber();
-    const std::vector<std::string>* overlayEventColNames = evt->getCollectionNames();
-    unsigned int nOverlayCollection = overlayEventColNames->size();
-    unsigned int nMergedCollection = _mergedCollectionNames.size();  
-
-    for(unsigned int i=0 ; i<nOverlayCollection ; i++){
 
-      std::map< std::string , std::string > CollectionMap;    	    
-      for(unsigned int j=0 ; j<nMergedCollection ; j++){
-
-	if( (*overlayEventColNames)[i] == _mergedCollectionNames[j]){
-
-	  CollectionMap[(*overlayEventColNames)[i]] = (*overlayEventColNames)[i];
-	}
-	Merger::merge(evt, outEvt, &CollectionMap);
-      }
-      CollectionMap.clear();
-    }
+    // a single pass over the event collections, names are matched by hash in the merge plan
+    Merger::merge(evt, outEvt, &_mergedCollectionMap, &_mergeContext);
   
 #ifdef MARLIN_USE_AIDA
 #endif
@@ -123,6 +120,9 @@ namespace overlay{
 
   void OverlayEvents::end(){
 
+    // pack the pixel hits accumulated over all events
+    _mergeContext.flush();
+
     // write LCIO file
     try{
       _lcWriter->writeEvent( outEvt );
@@ -31,7 +31,9 @@ namespace overlay {
   OverlayTiming aOverlayTiming;
 
   OverlayTiming::OverlayTiming( std::string const& procName) : Processor(procName)
-  {}
+  {
+    register_merge_parameters();
+  }
 
   OverlayTiming::OverlayTiming() : Processor("OverlayTiming")
   {
@@ -242,6 +244,8 @@ namespace overlay {
                                _DefaultStart_int,
                                float(-0.25));
 
+    register_merge_parameters();
+
     registerProcessorParameter("AllowReusingBackgroundFiles",
                                "If true the same background file can be used for the same event",
                                m_allowReusingBackgroundFiles,
@@ -275,12 +279,136 @@ namespace overlay {
 
     Global::EVENTSEEDER->registerProcessor(this);
 
+    init_merge_options();
+
     _nRun = 0;
     _nEvt = 0;
   }
 
   //------------------------------------------------------------------------------------------------------------------------------------------
 
+  void OverlayTiming::register_merge_parameters()
+  {
+    registerProcessorParameter("ContributionCompaction",
+                               "Compaction of the background MC contributions of SimCalorimeterHits : None, TimeBinned (per cell and time bin) or EnergyOnly (per cell)",
+                               _compaction,
+                               std::string("None"));
+
+    registerProcessorParameter("CompactionTimeBin",
+                               "Time bin width (ns) for the TimeBinned contribution compaction",
+                               _compactionTimeBin,
+                               float(1.));
+
+    registerProcessorParameter("BackgroundEnergyThresholds",
+                               "Pairs of SimCalorimeterHit collection name and energy threshold (GeV) below which background energy is not merged",
+                               _energyThresholds,
+                               StringVec());
+
+    registerProcessorParameter("EnergyThresholdMode",
+                               "What the BackgroundEnergyThresholds are applied to : Contribution (each background MC contribution) or CellSum (the cells created by the background)",
+                               _thresholdMode,
+                               std::string("Contribution"));
+
+    registerProcessorParameter("SimTrackerHitCellMerging",
+                               "Pairs of SimTrackerHit collection name and position grid (mm, 0: cellID only) whose background hits are aggregated per cell",
+                               _simTrackerHitCells,
+                               StringVec());
+  }
+
+  //------------------------------------------------------------------------------------------------------------------------------------------
+
+  void OverlayTiming::init_merge_options()
+  {
+    CompactionMode mode = kNoCompaction;
+
+    if (!compactionModeFromString(_compaction, mode))
+      {
+        throw Exception("OverlayTiming: invalid ContributionCompaction '" + _compaction + "', expected None, TimeBinned or EnergyOnly");
+      }
+
+    _compactor.setMode(mode, _compactionTimeBin);
+
+    std::map<std::string, float> thresholds;
+    ThresholdMode thresholdMode = kContributionThreshold;
+
+    if (!collectionValuesFromStrings(_energyThresholds, thresholds))
+      {
+        throw Exception("OverlayTiming: BackgroundEnergyThresholds needs pairs of collection name and threshold (GeV)");
+      }
+
+    for (const auto &threshold : thresholds)
+      {
+        if (threshold.second < 0.)
+          {
+            throw Exception("OverlayTiming: negative BackgroundEnergyThresholds value for collection " + threshold.first);
+          }
+      }
+
+    if (!thresholdModeFromString(_thresholdMode, thresholdMode))
+      {
+        throw Exception("OverlayTiming: invalid EnergyThresholdMode '" + _thresholdMode + "', expected Contribution or CellSum");
+      }
+
+    _energyFilter.setThresholds(thresholds, thresholdMode);
+
+    if (!collectionValuesFromStrings(_simTrackerHitCells, _simTrackerHitCellGrids))
+      {
+        throw Exception("OverlayTiming: SimTrackerHitCellMerging needs pairs of collection name and grid (mm)");
+      }
+
+    // 0 is a valid grid (cellID only), a negative one is a typo
+    for (const auto &grid : _simTrackerHitCellGrids)
+      {
+        if (grid.second < 0.)
+          {
+            throw Exception("OverlayTiming: negative SimTrackerHitCellMerging grid for collection " + grid.first);
+          }
+      }
+  }
+
+  //------------------------------------------------------------------------------------------------------------------------------------------
+
+  void OverlayTiming::add_contribution(IMPL::SimCalorimeterHitImpl *hit, EVENT::MCParticle *particle, float energy, float time)
+  {
+    if (_compactor.enabled())
+      {
+        _compactor.add(hit, particle, energy, time);
+      }
+    else
+      {
+        hit->addMCParticleContribution(particle, energy, time);
+      }
+  }
+
+  //------------------------------------------------------------------------------------------------------------------------------------------
+
+  void OverlayTiming::add_tracker_hit(EVENT::LCCollection *dest_collection, IMPL::SimTrackerHitImpl *hit, double grid)
+  {
+    if (grid < 0.)
+      {
+        dest_collection->addElement(hit);
+        return;
+      }
+
+    // only background hits are indexed, the hits of the physics event are kept as they are
+    const TrackerDestMap::key_type key(cellID2long(hit->getCellID0(), hit->getCellID1()), gridCell(hit->getPosition(), grid));
+    auto inserted = collTrackerDestMap[dest_collection].insert(TrackerDestMap::value_type(key, hit));
+
+    if (inserted.second)
+      {
+        dest_collection->addElement(hit);
+        return;
+      }
+
+    SimTrackerHitImpl *cellHit = static_cast<SimTrackerHitImpl*>(inserted.first->second);
+    cellHit->setEDep(cellHit->getEDep() + hit->getEDep());
+    cellHit->setTime(std::min(cellHit->getTime(), hit->getTime()));
+    delete hit;
+    ++_nAggregatedTrackerHits;
+  }
+
+  //------------------------------------------------------------------------------------------------------------------------------------------
+
   void OverlayTiming::processRunHeader(EVENT::LCRunHeader*)
   {
     _nRun++;
@@ -535,8 +663,12 @@ namespace overlay {
 
     delete permutation;
     ++_nEvt;
+    //write the compacted background contributions, if any, then drop the background cells below their cell sum threshold
+    _compactor.flush();
+    _energyFilter.flush();
     //we clear the map of calorimeter hits for the next event
     collDestMap.clear();
+    collTrackerDestMap.clear();
     const std::vector<std::string> *collection_names_in_evt = evt->getCollectionNames();
 
     for (unsigned int i = 0; i < collection_names_in_evt->size(); ++i)
@@ -652,7 +784,9 @@ namespace overlay {
 		  }
                 else if ((not_within_time_window > 0) && (not_within_time_window < CalorimeterHit->getNMCContributions()))
 		  {
+                    // contributions cannot be removed from a hit: replace it
                     SimCalorimeterHitImpl *newCalorimeterHit = new SimCalorimeterHitImpl();
+                    ++_nCroppedCalorimeterHits;
 
                     for (int j = 0; j < CalorimeterHit->getNMCContributions(); ++j)
 		      {
@@ -693,6 +827,9 @@ namespace overlay {
     const int number_of_elements = source_collection->getNumberOfElements();
     int mergedN = 0;
     streamlog_out(DEBUG) << "We are starting the merge with " << dest_collection->getNumberOfElements() << std::endl;
+    // aggregation grid of the background tracker hits, < 0: no aggregation
+    const auto tracker_grid_it = _simTrackerHitCellGrids.find(currentDest);
+    const double tracker_grid = (tracker_grid_it == _simTrackerHitCellGrids.end()) ? -1. : std::max(0.f, tracker_grid_it->second);
     if (number_of_elements > 0)
       {
         if (source_collection->getTypeName() == LCIO::MCPARTICLE)
@@ -717,8 +854,8 @@ namespace overlay {
 		  {
                     TrackerHit->setTime( TrackerHit->getTime() + time_offset);
                     TrackerHit->setOverlay(true);
-                    dest_collection->addElement(TrackerHit);
                     source_collection->removeElementAt(k);
+                    add_tracker_hit(dest_collection, TrackerHit, tracker_grid);
 		  }
 	      }
 	  }
@@ -743,49 +880,81 @@ namespace overlay {
 		      }
                     TrackerHit->setPosition(ort);
                     TrackerHit->setOverlay(true);
-                    dest_collection->addElement(TrackerHit);
                     source_collection->removeElementAt(k);
+                    add_tracker_hit(dest_collection, TrackerHit, tracker_grid);
 		  }
 	      }
 	  }
         else if (source_collection->getTypeName() == LCIO::SIMCALORIMETERHIT)
 	  {
+            _energyFilter.beginCollection(dest_collection, currentDest);
+            const bool filtering = _energyFilter.filtersContributions();
+
             // create a map of dest Collection
             for (int k =  number_of_elements - 1; k >= 0; --k) 
 	      {
                 SimCalorimeterHit *CalorimeterHit = static_cast<SimCalorimeterHit*>(source_collection->getElementAt(k));
                 const float _time_of_flight = time_of_flight(CalorimeterHit->getPosition()[0], CalorimeterHit->getPosition()[1], CalorimeterHit->getPosition()[2]);
 
+                if (filtering)
+		  {
+                    _energyFilter.select(CalorimeterHit);
+		  }
+
+                // contribution in the time window and above the energy threshold, if any
+                auto accepted = [&](int j)
+		  {
+                    if (!(((CalorimeterHit->getTimeCont(j) + time_offset) > (this_start + _time_of_flight)) && ((CalorimeterHit->getTimeCont(j) + time_offset) < (this_stop + _time_of_flight))))
+		      {
+                        return false;
+		      }
+                    if (filtering && !_energyFilter.selected(j))
+		      {
+                        _energyFilter.reject(CalorimeterHit->getEnergyCont(j));
+                        return false;
+		      }
+                    return true;
+		  };
+
                 //check whether there is already a hit at this position
                 const unsigned long long lookfor = cellID2long(CalorimeterHit->getCellID0(), CalorimeterHit->getCellID1());
                 DestMap::const_iterator destMapIt = collDestMap[currentDest].find(lookfor);
                 if (destMapIt == collDestMap[currentDest].end())
 		  {
                     // There is no Hit at this position -- the new hit can be added, if it is not outside the window
-                    SimCalorimeterHitImpl *newCalorimeterHit = new SimCalorimeterHitImpl();
-                    bool add_Hit = false;
+                    // look for the first contribution in the window before allocating anything: most background hits have none
+                    const int n_contributions = CalorimeterHit->getNMCContributions();
+                    int first_in_window = 0;
 
-                    for (int j = 0; j < CalorimeterHit->getNMCContributions(); ++j)
+                    while ((first_in_window < n_contributions) && !accepted(first_in_window))
 		      {
-                        if (((CalorimeterHit->getTimeCont(j) + time_offset) > (this_start + _time_of_flight)) && ((CalorimeterHit->getTimeCont(j) + time_offset) < (this_stop + _time_of_flight)))
-			  {
-                            add_Hit = true;
-                            newCalorimeterHit->addMCParticleContribution(CalorimeterHit->getParticleCont(j), CalorimeterHit->getEnergyCont(j), CalorimeterHit->getTimeCont(j) + time_offset);
-			  }
+                        ++first_in_window;
 		      }
-                    if (add_Hit)
+
+                    if (first_in_window == n_contributions)
 		      {
-                        newCalorimeterHit->setCellID0(CalorimeterHit->getCellID0());
-                        newCalorimeterHit->setCellID1(CalorimeterHit->getCellID1());
-                        float ort[3] = {CalorimeterHit->getPosition()[0],CalorimeterHit->getPosition()[1], CalorimeterHit->getPosition()[2]};
-                        newCalorimeterHit->setPosition(ort);
-                        dest_collection->addElement(newCalorimeterHit);
-			collDestMap[currentDest].insert(DestMap::value_type(cellID2long(newCalorimeterHit->getCellID0(), newCalorimeterHit->getCellID1()), newCalorimeterHit));
+                        ++_nSkippedCalorimeterHits;
+                        continue;
 		      }
-                    else
+
+                    SimCalorimeterHitImpl *newCalorimeterHit = new SimCalorimeterHitImpl();
+                    ++_nCreatedCalorimeterHits;
+
+                    for (int j = first_in_window; j < n_contributions; ++j)
 		      {
-                        delete newCalorimeterHit;
+                        if (accepted(j))
+			  {
+                            add_contribution(newCalorimeterHit, CalorimeterHit->getParticleCont(j), CalorimeterHit->getEnergyCont(j), CalorimeterHit->getTimeCont(j) + time_offset);
+			  }
 		      }
+
+                    newCalorimeterHit->setCellID0(CalorimeterHit->getCellID0());
+                    newCalorimeterHit->setCellID1(CalorimeterHit->getCellID1());
+                    float ort[3] = {CalorimeterHit->getPosition()[0],CalorimeterHit->getPosition()[1], CalorimeterHit->getPosition()[2]};
+                    newCalorimeterHit->setPosition(ort);
+                    dest_collection->addElement(newCalorimeterHit);
+                    _energyFilter.watch(newCalorimeterHit);
+                    collDestMap[currentDest].insert(DestMap::value_type(cellID2long(newCalorimeterHit->getCellID0(), newCalorimeterHit->getCellID1()), newCalorimeterHit));
 		  }
                 else
 		  {
@@ -821,9 +990,9 @@ namespace overlay {
 		    }
 		    for (int j = 0; j < CalorimeterHit->getNMCContributions(); ++j)
 		      {
-                        if (((CalorimeterHit->getTimeCont(j) + time_offset) > (this_start + _time_of_flight)) && ((CalorimeterHit->getTimeCont(j) + time_offset) < (this_stop + _time_of_flight)))
+                        if (accepted(j))
 			  {
-                            newCalorimeterHit->addMCParticleContribution(CalorimeterHit->getParticleCont(j), CalorimeterHit->getEnergyCont(j), CalorimeterHit->getTimeCont(j) + time_offset);
+                            add_contribution(newCalorimeterHit, CalorimeterHit->getParticleCont(j), CalorimeterHit->getEnergyCont(j), CalorimeterHit->getTimeCont(j) + time_offset);
 			  }
 		      }
 		  }
@@ -847,6 +1016,25 @@ namespace overlay {
 
   void OverlayTiming::end()
   {
+    if (_compactor.enabled())
+      {
+        streamlog_out(MESSAGE) << "OverlayTiming: " << _compactor.getNAdded() << " background calorimeter contributions compacted into "
+                               << _compactor.getNWritten() << std::endl;
+      }
+
+    if (_energyFilter.enabled())
+      {
+        streamlog_out(MESSAGE) << "OverlayTiming: background energy below threshold: " << _energyFilter.getNRejectedContributions() << " contributions ("
+                               << _energyFilter.getRejectedContributionEnergy() << " GeV), " << _energyFilter.getNRejectedCells() << " cells ("
+                               << _energyFilter.getRejectedCellEnergy() << " GeV)" << std::endl;
+      }
+
+    streamlog_out(MESSAGE) << "OverlayTiming: calorimeter hits allocated for background hits: " << _nCreatedCalorimeterHits
+                           << ", for physics hits cropped to the time window: " << _nCroppedCalorimeterHits
+                           << ", background hits with nothing to add (no allocation): " << _nSkippedCalorimeterHits
+                           << ", background tracker hits aggregated into a cell: " << _nAggregatedTrackerHits
+                           << std::endl;
+
     delete overlay_Eventfile_reader;
     overlay_Eventfile_reader = nullptr;
   }
@@ -105,6 +105,8 @@ void OverlayTimingGeneric::init()
 
   marlin::Global::EVENTSEEDER->registerProcessor(this);
 
+  init_merge_options();
+
   _nRun = 0;
   _nEvt = 0;
 